@@ -3,6 +3,13 @@ Weather Simulation
 Written by Scott Friedman and Mike Nichols
 UCLA Academic Technology Services
 
+Headless mode:
+-o prefix renders to prefix00000.png, prefix00001.png... without a display
+or GPU, through an EGL pbuffer, and reports the frame rate. With it:
+-a attribute, numbered like the keys below(default 1 = Snowpack)
+-t first:last timesteps to render(default all of them)
+-s widthxheight of the images(default 1280x720)
+
 Movement keys:
 UP = move up
 DOWN = move down
@@ -11,18 +18,31 @@ RIGHT = move right
 PAGE_UP = zoom in
 PAGE_DOWN = zoom out
 
+Mouse:
+left drag = draw a slice line
+right click(or drag) = plot every attribute over the whole run at that point
+shift + right click(or drag) = the same, averaged over the 9x9 points around it
+
 Function keys:
 Numbers toggle weather attributes
 1 = Snowpack
 2 = Snowfall
 3 = Precipitation
 4 = Runoff
+5-8 = daily changes of the above
+9 = Snowpack observed at the stations, interpolated onto the grid
 
 [ = Transparency down
 ] = Transparency up
 
-T = toggles drawing of surface maps
+B = toggles playing the simulation backwards
+H = toggles the time-distance(Hovmoller) view of the slice
+T = toggles drawing of surface maps(tiles load in the background as the view moves)
 D = toggles drawing of station data
+V = toggles the model vs snow pillow validation overlay(computed and written
+    to validation.csv the first time)
+A = totals the current attribute over each region(entity) of the region
+    shapefile for every timestep and writes them to regions.csv
 L = toggles drawing of shape outlines for states/countries
 */
 
@@ -35,21 +55,42 @@ L = toggles drawing of shape outlines for states/countries
 #include <string.h>
 #include <netcdfcpp.h>
 #include <vector>
+#include <map>
+#include <set>
+#include <deque>
 #include <time.h>
 #include <algorithm>
 #include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <errno.h>
+#ifdef __SSE__
+#include <xmmintrin.h>
+#endif
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 #define GL_GLEXT_PROTOTYPES
 #define GLX_GLXEXT_PROTOTYPES
 #include <GL/glx.h>
 #include <GL/glut.h>
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
 
 #include <libshp/shapefil.h>
 
-#include <IL/il.h>
-#define ILUT_USE_OPENGL
-#include <IL/ilu.h>
-#include <IL/ilut.h>
+#include <stdio.h>
+#include <setjmp.h>
+extern "C" {
+#include <jpeglib.h>
+}
+
+#include <png.h>
 
 #define CORRECT_TEX_LOC
 
@@ -62,6 +103,10 @@ L = toggles drawing of shape outlines for states/countries
 // uncomment the line below to print draw time for shape data
 //#define SHP_TIMING_ON
 
+// uncomment the line below to draw shape data one part at a time at full
+// resolution, the old way (useful for comparing with SHP_TIMING_ON)
+//#define SHP_UNBATCHED
+
 // uncomment the line below to use real z data for the csv coords
 //#define DRAWING_3D
 
@@ -78,6 +123,10 @@ L = toggles drawing of shape outlines for states/countries
 // uncomment the line below to turn on slice graph color
 //#define SLICE_COLOR_ON
 
+// uncomment the line below to interpolate the station data onto the grid with
+// ordinary kriging instead of inverse distance weighting(much slower)
+//#define OBSERVED_KRIGING
+
 #define DEBUG
 #define DRAW_DEBUGX
 //#define DEBUG2
@@ -88,11 +137,6 @@ L = toggles drawing of shape outlines for states/countries
 
 using namespace std;
 
-extern "C" {
-	extern void dgesv_(int *n, int *nrhs, double *a, int *lda, int *ipiv,
-			double *b, int *ldb, int *info);
-};
-
 typedef struct {
 	float x;
 	float y;
@@ -117,9 +161,98 @@ typedef enum {
 	SNOWFALL_DAILY = 5,
 	PRECIPITATION_DAILY = 6,
 	RUNOFF_DAILY = 7,
-	ATTR_MAX = 7,
+	OBSERVED_SNOWPACK = 8,
+	ATTR_MAX = 8,
 } attribute_t;
 
+// header of the binary cache of ingested weather data. It is followed by
+// weatherCoords and then, at dataOffset, the four attribute arrays.
+typedef struct {
+	char magic[8];
+	int version;
+	int numRows, numCols, numNcFiles;
+	long timeSize, recSize;
+	// hash of the names, sizes and mtimes of the input Ncfiles
+	unsigned long long signature;
+	float attrMin[8], attrMax[8];
+	long dataOffset;
+} cacheheader_t;
+
+// everything the colors of the weather grid depend on
+typedef struct {
+	int attrNum;
+	int timeStep;
+	GLubyte transparency;
+	int transferVersion;
+} colorkey_t;
+
+// Every outline of one shapefile at every level of detail, packed into one
+// vertex buffer. first/count hold each part's range for glMultiDrawArrays.
+typedef struct {
+	GLuint buffer;
+	// x,y interleaved, only kept until it's uploaded
+	vector<float> vertices;
+	vector< vector<GLint> > first;
+	vector< vector<GLsizei> > count;
+} shapebatch_t;
+
+// All the outlines of one shapefile, flattened. The parts of entity e are
+// partStart[entityStart[e]] .. partStart[entityStart[e + 1]] and the vertices
+// of part p are coords[2 * partStart[p]] .. coords[2 * partStart[p + 1] - 1],
+// x,y interleaved. The arrays point into map when they came from the sidecar
+// cache, otherwise they were allocated with new[].
+typedef struct {
+	int numEntities, numParts, numPoints;
+	int *entityStart;
+	int *partStart;
+	float *coords;
+	void *map;
+	size_t mapSize;
+} shapedata_t;
+
+// header of a shapefile's sidecar cache, followed by entityStart, partStart and coords
+typedef struct {
+	char magic[8];
+	int version;
+	int numEntities, numParts, numPoints;
+	// size and mtime of the .shp file
+	long long shpSize, shpTime;
+} shapecacheheader_t;
+
+// the slice along the current line of one attribute at one timestep
+typedef struct {
+	int attr;
+	int timeStep;
+	int tableVersion;
+	vector<float> data;
+} slicecache_t;
+
+// everything the slice window shows, so it's only redrawn when one changes
+typedef struct {
+	coord_t start, end;
+	long steps;
+	int attrNum;
+	int timeStep;
+	GLubyte transparency;
+	int transferVersion;
+	bool hovmoller;
+	bool drawingLine;
+} slicekey_t;
+
+// running sums of the model vs observed snowpack at one or more stations
+typedef struct {
+	long n;
+	double sumModel, sumObs;
+	double sumModel2, sumObs2, sumModelObs;
+} validsums_t;
+
+typedef struct {
+	long numDays;
+	float bias;
+	float rmse;
+	float correlation;
+} validation_t;
+
 typedef enum {
 	TEXT_UP,
 	TEXT_DOWN,
@@ -158,6 +291,7 @@ const float MAX_FLOAT = std::numeric_limits<float>::max();
 const float MIN_FLOAT = std::numeric_limits<float>::min();
 const int MAX_INT = std::numeric_limits<int>::max();
 const float SLICE_GRAPH_WIDTH = 1000.0, SLICE_GRAPH_HEIGHT = 200.0;
+const float PROBE_GRAPH_WIDTH = 1000.0, PROBE_GRAPH_HEIGHT = 300.0;
 // distance the text is drawn in front of "camera"
 const float TEXT_DIST = 0.05;
 // this the value which defines the limit of negligible values in the daily data
@@ -168,23 +302,42 @@ const int SLICE_XAXIS_COORDS = 8;
 void *BIG_FONT = GLUT_BITMAP_9_BY_15;
 void *LITTLE_FONT = GLUT_BITMAP_HELVETICA_10;
 // initialization vectors
-vector<int> intVector;
-vector<float> floatVector;
 vector<GLuint> gluintVector;
-vector< vector<int> > intVectorVector;
-vector< vector<float> > floatVectorVector;
 
 // Global Variables
 // identifiers for the main and sub screen
-int mainWindow = -1, sliceWindow = -1;
+int mainWindow = -1, sliceWindow = -1, probeWindow = -1;
 int screenWidth = 1280, screenHeight = 720;
 int screenWidth2 = 0.65 * screenWidth, screenHeight2 = screenHeight / 4;
+int screenWidth3 = screenWidth2, screenHeight3 = screenHeight / 3;
+
+// right click probe: the series of all 4 attributes at one grid point(or
+// averaged over the points within PROBE_AREA_RADIUS of it with shift), plus
+// what the probe window last showed so it's only redrawn on a change
+const int PROBE_AREA_RADIUS = 4;
+bool probing = false, probeArea = false;
+int probePoint = -1;
+bool probeSeriesArea = false;
+// set while the probe waits for the time-major layout
+bool probePending = false;
+vector<float> probeSeries[4];
+int probeWindowPoint = -1, probeWindowTimeStep = -1;
 
 transnum_t transNum = TRANS_ONE;
 // holds data imported from text file about weather transfer function
 vector<trans_t> transFuncData;
 // TODO: different transfer functions for each attribute
 //vector< vector<trans_t> > transFuncData;
+// transFuncData compiled into RGBA bins over its value range, so colorizing a
+// value is a scale, a clamp and one table load. Entry 0 is for values at or
+// below the first transfer value, entries 1..TRANS_LUT_SIZE cover the rest.
+const int TRANS_LUT_SIZE = 4096;
+GLubyte transLUT[4 * (TRANS_LUT_SIZE + 1)];
+float transLUTMin, transLUTScale;
+// the transparency the alpha channel of transLUT was filled with
+GLubyte transLUTAlpha;
+// bumped whenever transLUT is rebuilt
+int transferVersion = 0;
 
 coord_t debugA, debugB, debugC, debugD;
 coord_t debugX = {9001, 9001, 9001};
@@ -209,39 +362,279 @@ bool leftMouseIsDown = false;
 
 // location for each weather station
 vector<coord_t> csvCoords;
-// outer layer is each time step(day)
-// inner layer is each weather station
-vector< vector<float> > csvData;
+vector<string> csvNames;
+// days x stations matrix, the value of station s on row d is at
+// csvData[d * numCsvStations + s]. Stations are in the order of csvCoords.
+vector<float> csvData;
+int numCsvDays = 0, numCsvStations = 0;
+// stations without a reading on a day
+const float CSV_MISSING = -9999.0;
+// the DAY column of each row of csvData, 1 is the first day of the simulation
+vector<int> csvDays;
 float csvMin = MAX_FLOAT, csvMax = -MAX_FLOAT;
 bool shouldDrawStations = false;
 
+// Model snowpack vs the snow pillows. The pillows report cm of water and the
+// model kg/m^2, which is mm of water.
+const float PILLOW_TO_MODEL_UNITS = 10.0;
+char *validationPath = "validation.csv";
+vector<validation_t> stationValidation;
+validation_t networkValidation;
+bool validationDone = false;
+bool shouldDrawValidation = false;
+
+// The station data interpolated onto the grid, one record per day of the
+// simulation. It's the data behind OBSERVED_SNOWPACK, and its slot among the
+// data attributes is OBSERVED_DATA(see dataAttribute()).
+const int OBSERVED_DATA = 4;
+float *observedData = NULL;
+int numObservedDays = 0;
+const int IDW_NEIGHBORS = 8;
+// extra neighbors found per grid point, for days some stations are missing
+const int IDW_CANDIDATES = IDW_NEIGHBORS + 4;
+const float IDW_POWER = 2.0;
+// range of the exponential variogram used for kriging, in degrees
+const float KRIGING_RANGE = 0.5;
+// uniform bin grid over the stations for the neighbor search, the stations in
+// bin b are stationBinStations[stationBinStart[b]] .. [stationBinStart[b+1] - 1]
+int stationBinCols = 0, stationBinRows = 0;
+float stationBinX, stationBinY, stationBinSize;
+vector<int> stationBinStart;
+vector<int> stationBinStations;
+
 GLubyte transparency;
 textpos_t datePosition = TEXT_DOWN;
 
 int weatherAttrNum;
 float *weatherCoords = NULL;
-float *weatherData = NULL;
+// colors of the weather grid from the last redraw and what they were computed for
+GLubyte *weatherColors = NULL;
+colorkey_t weatherColorsKey = {-1, -1, 0, -1};
 float *snowpackData = NULL;
 float *snowfallData = NULL;
 float *precipitationData = NULL;
 float *runoffData = NULL;
 
-float weatherAttrMin[8] = {MAX_FLOAT, MAX_FLOAT, MAX_FLOAT, MAX_FLOAT, 
-	MAX_FLOAT, MAX_FLOAT, MAX_FLOAT, MAX_FLOAT};
-float weatherAttrMax[8] = {-MAX_FLOAT, -MAX_FLOAT, -MAX_FLOAT, -MAX_FLOAT, 
-	-MAX_FLOAT, -MAX_FLOAT, -MAX_FLOAT, -MAX_FLOAT};
+float weatherAttrMin[ATTR_MAX + 1] = {MAX_FLOAT, MAX_FLOAT, MAX_FLOAT, MAX_FLOAT, 
+	MAX_FLOAT, MAX_FLOAT, MAX_FLOAT, MAX_FLOAT, MAX_FLOAT};
+float weatherAttrMax[ATTR_MAX + 1] = {-MAX_FLOAT, -MAX_FLOAT, -MAX_FLOAT, -MAX_FLOAT, 
+	-MAX_FLOAT, -MAX_FLOAT, -MAX_FLOAT, -MAX_FLOAT, -MAX_FLOAT};
 
 // very important
 int totalTimeSteps;
 int currentTimeStep = 0;
+// 1 plays forward, -1 plays backward
+int playbackDirection = 1;
 long recSize, timeSize, totalSliceSteps;
 int numCols, numRows, numNcFiles;
 
+// number of worker processes used to ingest the Ncfiles(and of threads used to
+// load map tiles and encode frames), 0 is one per core
+int numIngestThreads = 0;
+// the netCDF library(and HDF5 under it) isn't thread safe, so opening,
+// reading and closing files must be serialized between threads. The ingest
+// gets around it with processes, see runIngestWorkers().
+pthread_mutex_t ncMutex = PTHREAD_MUTEX_INITIALIZER;
+// the attribute arrays when they were ingested rather than mapped from the
+// cache, shared so the ingest workers can write into them
+void *weatherDataMap = NULL;
+size_t weatherDataSize = 0;
+
+// binary cache of the ingested data, NULL turns it off
+char *weatherCachePath = "ingest.cache";
+const char WEATHER_CACHE_MAGIC[8] = "WXCACHE";
+// bump this whenever the layout of the cache changes
+const int WEATHER_CACHE_VERSION = 1;
+// the mapping the weather data points into when it came from the cache
+void *weatherCacheMap = NULL;
+size_t weatherCacheSize = 0;
+
+// Streaming mode keeps only a window of timesteps resident instead of the
+// whole run. The window is a ring buffer where timestep t lives in slot
+// t % streamWindow, and each slot holds the records of all 4 attributes.
+bool streaming = false;
+int streamWindow = 0;
+char **ncFileNames = NULL;
+float *streamData = NULL;
+// the timestep held by each slot, -1 when empty
+int *streamSlotStep = NULL;
+bool *streamSlotLoading = NULL;
+// set for the timesteps whose last load failed, so the loader doesn't retry them
+vector<char> streamStepFailed;
+
+// What each thread reading timesteps needs of its own, see openFetch(). In
+// streaming mode: a record to read into, scratch for the combined fields and
+// the Ncfile it has open, kept open since consecutive timesteps usually share one.
+typedef struct {
+	float *record, *scratch;
+	NcFile *openFile;
+	int openFileNum;
+} fetchstate_t;
+
+// the background loader prefetches around this timestep in the direction of playback
+int streamCenter = 0;
+int streamDirection = 1;
+bool streamStop = false;
+bool streamThreadStarted = false;
+pthread_t streamThread;
+pthread_mutex_t streamMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t streamCond = PTHREAD_COND_INITIALIZER;
+
+// Time-major copy of the attribute arrays, built in the background after the
+// ingest unless -L is given or it wouldn't fit in memory. The grid is cut into TILE_SIZE x TILE_SIZE tiles of points. Every
+// point's whole series is contiguous and the points of a tile are stored
+// together, so point and area time series are sequential reads.
+const int TILE_SIZE = 8;
+int numTileCols = 0, numTileRows = 0;
+float *timeMajorData[4] = {NULL, NULL, NULL, NULL};
+bool buildTimeMajor = true;
+bool timeMajorReady = false;
+bool timeMajorStop = false;
+bool timeMajorThreadStarted = false;
+pthread_t timeMajorThread;
+pthread_mutex_t timeMajorMutex = PTHREAD_MUTEX_INITIALIZER;
+
+// libjpeg calls exit() on errors unless error_exit is replaced
+typedef struct {
+	struct jpeg_error_mgr pub;
+	jmp_buf jump;
+} jpegerror_t;
+
+// An image's pyramid is kept on disk next to it, or under $TMPDIR when its
+// directory is read only, see buildImagePyramid().
+// Level 0 is full resolution, every level above halves it, and the top level
+// fits in one tile.
+typedef struct {
+	char *fileName;
+	string pyramidDir;
+	int width, height, numLevels;
+	// set by the loader once the pyramid is on disk
+	bool ready;
+} mapimage_t;
+const int TILE_PIXELS = 512;
+vector<mapimage_t> mapImages;
+
+// one tile of one level of one image's pyramid
+typedef struct tilekey_t {
+	int image, level, row, col;
+	bool operator<(const tilekey_t &other) const {
+		if (image != other.image) return image < other.image;
+		if (level != other.level) return level < other.level;
+		if (row != other.row) return row < other.row;
+		return col < other.col;
+	}
+} tilekey_t;
+
+// a decoded tile waiting to be uploaded, pixels is NULL if it couldn't be read
+typedef struct {
+	tilekey_t key;
+	unsigned char *pixels;
+	int width, height;
+} tiledecode_t;
+
+// a tile in texture memory, lastUsed is the frame it was last drawn in
+typedef struct {
+	GLuint texture;
+	long lastUsed;
+	long bytes;
+} residenttile_t;
+
+// The tiles drawn are kept in texture memory up to TILE_TEXTURE_BUDGET bytes,
+// then the least recently drawn ones are let go.
+const long TILE_TEXTURE_BUDGET = 256L * 1024 * 1024;
+map<tilekey_t, residenttile_t> residentTiles;
+long residentTileBytes = 0;
+long tileFrame = 0;
+
+// The map tiles are loaded by a pool of threads while the simulation runs.
+// The workers first make sure every image has its pyramid on disk, then decode
+// the tiles redraw() asks for in tileRequests and hand their pixels back
+// through tilesDecoded; animate() uploads a few of those per frame on the GL
+// thread. All of these are guarded by tileMutex.
+deque<tilekey_t> tileRequests;
+set<tilekey_t> tilesLoading;
+vector<tiledecode_t> tilesDecoded;
+int pyramidNext = 0;
+int pyramidsDone = 0;
+// tiles that couldn't be decoded, so they aren't asked for again
+set<tilekey_t> tilesFailed;
+bool tileLoaderStop = false;
+vector<pthread_t> tileLoaderThreads;
+pthread_mutex_t tileMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t tileCond = PTHREAD_COND_INITIALIZER;
+// more than this per frame stalls the animation
+const int TEXTURE_UPLOADS_PER_FRAME = 2;
+
+// Frames being saved are read back asynchronously through two pixel buffer
+// objects: each frame starts its transfer into one while the frame before it
+// is mapped from the other, which has had a whole frame to arrive. The pixels
+// are compressed to PNG by a pool of encoders behind a bounded queue, so
+// rendering goes on while earlier frames are written.
+typedef struct {
+	string fileName;
+	// RGBA, bottom row first as GL reads it
+	unsigned char *pixels;
+	int width, height;
+} captureframe_t;
+GLuint capturePBOs[2] = {0, 0};
+int capturePBOWidth = 0, capturePBOHeight = 0;
+int captureNext = 0;
+// the file each buffer's transfer is for, empty when it holds nothing
+string capturePBONames[2];
+// the file animate() wants the next frame redraw() draws saved as
+string captureRequest;
+// everything below is guarded by captureMutex
+deque<captureframe_t> captureQueue;
+int captureEncoding = 0;
+bool captureStop = false;
+pthread_mutex_t captureMutex = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t captureReady = PTHREAD_COND_INITIALIZER;
+pthread_cond_t captureDone = PTHREAD_COND_INITIALIZER;
+vector<pthread_t> encoderThreads;
+// frames waiting to be encoded, more than this and capturing waits on the encoders
+const int CAPTURE_QUEUE_SIZE = 8;
+// seconds capturing has spent waiting for room in the queue
+double captureWaitTime = 0.0;
+
+// Headless mode(-o) renders a range of timesteps into an EGL pbuffer instead
+// of a window and saves each frame as headlessPrefixNNNNN.png.
+bool headless = false;
+char *headlessPrefix = NULL;
+int headlessAttr = SNOWPACK;
+int headlessFirst = 0, headlessLast = -1;
+EGLDisplay headlessDisplay = EGL_NO_DISPLAY;
+EGLSurface headlessSurface = EGL_NO_SURFACE;
+EGLContext headlessContext = EGL_NO_CONTEXT;
+
 vector<coord_t> sliceLegendCoords;
+
+// cell(see traceSliceCells()) and bilinear weights of every sample along the
+// slice line, rebuilt only when the line changes
+vector<int> sliceCells;
+vector<float> sliceWeights;
+coord_t sliceTableStart, sliceTableEnd;
+long sliceTableSteps = -1;
+int sliceTableVersion = 0;
+// enough recent slices for the current and previous timestep in daily mode
+const int SLICE_CACHE_SIZE = 4;
+slicecache_t sliceCache[SLICE_CACHE_SIZE];
+int sliceCacheNext = 0;
+slicekey_t sliceWindowKey = {{0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, -1, -1, -1, 0, -1, false, false};
+
+// Hovmoller view: the slice at every timestep, stored [timeStep][sliceStep],
+// computed once per line and data attribute. The colors are redone when the
+// attribute, transparency or transfer function changes.
+bool hovmollerMode = false;
+float *hovmollerData = NULL;
+GLubyte *hovmollerColors = NULL;
+GLuint hovmollerTexture = 0;
+int hovmollerDataAttr = -1, hovmollerSteps = 0;
+coord_t hovmollerStart, hovmollerEnd;
+colorkey_t hovmollerColorsKey = {-1, -1, 0, -1};
 gridloc_t startPos = INSIDE;
 gridloc_t endPos = INSIDE;
 
-GLuint *textures;
+// lower left corner of each map image, same indexing as mapImages
 vector<coord_t> texCoords;
 bool shouldDrawTextures = true;
 
@@ -254,36 +647,62 @@ double tanViewAngle = tan(viewAngle);
 //vector<float> weatherCoords;
 // outer layer is each pair of rows
 vector< vector<GLuint> > weatherIndices;
+// GPU copies of the grid. The coords and the indices of every row, joined into
+// one strip, are uploaded once; only the colors are streamed when they change.
+GLuint weatherVertexBuffer = 0, weatherIndexBuffer = 0, weatherColorBuffer = 0;
+GLsizei weatherIndexCount = 0;
+// rows are joined with a restart index where the GL has it (3.1+), otherwise
+// with degenerate triangles
+bool usePrimitiveRestart = false;
+const GLuint RESTART_INDEX = 0xFFFFFFFF;
 vector<float> weatherOutline;
 bool shouldDrawOutline = true;
-
-/*
-Each vector below represents data for all shapefiles
-	shapeCoords holds all the (x,y) coordinates for all entities in all shapefiles
-	partOffsets holds all the initial indices for each part of each entity for all shapefiles
-
-Each entry vector[i] below holds all the data for one shapefile
-	shapeCoords[0] holds all (x,y) coords for all parts of all entities for fileNum == 0
-	partOffsets[0] holds all the initial indices for each part of each entity for fileNum == 0
-
-Each entry vector[i][j] holds data for all the (x,y) coords of one entity in one file
-	shapeCoords[0][2] holds all the (x,y) coords for entity == 2 in fileNum == 0
-	partOffsets[3][50] holds all the initial indices for each part of entity == 50 in fileNum == 3
-
-Each entry vector[i][j][k] holds one (x,y) coordinate for one entity in one shapefile
-These coordinates are interleaved like this: (x0, y0, x1, y1, x2, y2 ...etc.)
-	shapeCoords[3][1][4] holds one x coordinate for point == 4, entity == 1 in fileNum == 3
-	shapeCoords[3][1][5] holds the corresponding y coordinate for that vertex
-	partOffsets[1][9][5] holds the initial index for part == 5 of entity == 9 in fileNum == 1
-	The indices this part would only go from partOffsets[1][9][5] to partOffsets[1][9][6] - 1
-*/
-vector< vector< vector<float> > > shapeCoords;
-vector< vector< vector<int> > > partOffsets;
+// uniform bin grid over the bounding box of the weather grid for point
+// location. The cells whose bounding box overlaps bin b are stored, by the
+// index of the x coord of their lower left corner, in
+// cellBinCells[cellBinStart[b]] .. cellBinCells[cellBinStart[b+1] - 1]
+int cellBinCols = 0, cellBinRows = 0;
+float cellBinWidth = 1.0, cellBinHeight = 1.0;
+vector<int> cellBinStart;
+vector<int> cellBinCells;
+
+// one entry per shapefile, in the order they were given on the command line
+vector<shapedata_t> shapeFiles;
 bool shouldDrawShapes = true;
+// one entry per shapefile, same indexing as shapeFiles
+vector<shapebatch_t> shapeBatches;
+// a shapefile's sidecar cache is its name with .shp replaced by this
+const char *SHAPE_CACHE_EXTENSION = ".shpcache";
+const char SHAPE_CACHE_MAGIC[8] = "SHCACHE";
+// bump this whenever the layout of the sidecar cache changes
+const int SHAPE_CACHE_VERSION = 1;
+vector<string> shapeFileNames;
+
+// The entities of the region shapefile(-r) are the regions totals are done
+// over. The grid points inside region r are
+// regionCells[regionStart[r]] .. regionCells[regionStart[r + 1] - 1], and the
+// area each of them stands for(m^2) is at the same index of regionCellAreas.
+int regionFileNum = 0;
+bool regionIndexBuilt = false;
+int numRegions = 0;
+vector<string> regionNames;
+vector<int> regionStart;
+vector<int> regionCells;
+vector<float> regionCellAreas;
+// total water of regionTotalsAttr in each region in m^3, [timeStep][region]
+vector<double> regionTotals;
+int regionTotalsAttr = -1;
+char *regionPath = "regions.csv";
+const double EARTH_RADIUS = 6371000.0;
+// Douglas-Peucker tolerance (degrees) of each level of detail. A level is drawn
+// once it is within half a pixel at the current zoom.
+const int SHAPE_LOD_LEVELS = 5;
+const float SHAPE_LOD_TOLERANCE[SHAPE_LOD_LEVELS] = {0.0, 0.002, 0.008, 0.032, 0.128};
 
 // to make the compiler happy
 void reshape(int w, int h);
 void reshape2(int w, int h);
+void reshape3(int w, int h);
 void zoom(int direction);
 void move(char direction);
 void animate(void);
@@ -294,34 +713,156 @@ void mouse(int button, int state, int x, int y);
 void vis(int visible);
 void redraw(void);
 void redraw2(void);
+void redraw3(void);
+void probe(int x, int y, bool following);
+void updateProbeWindow(void);
 void drawBitmapString(float x, float y, float z, void *font, char *string);
 void drawTriangle(coord_t center, float size);
 void drawX(coord_t center, float size);
 void drawStations(int day);
+void computeValidation(void);
+void addValidationSums(validsums_t &sums, double model, double obs);
+validation_t finishValidation(const validsums_t &sums);
+void writeValidationCSV(char *fileName);
+void drawValidation(void);
+bool isDailyAttribute(int attrNum);
+void buildStationIndex(void);
+int findNearestStations(float x, float y, int k, int *nearest, float *dist);
+float idwValue(const float *obs, const int *nearest, const float *dist, int n);
+float krigingValue(const float *obs, const int *nearest, const float *dist, int n, float sill);
+bool solveLinearSystem(double *a, double *b, int n);
+void computeObservedSnowpack(void);
+float *observedTimeStep(int timeStep);
 void drawText(int totalDays);
 void drawTransferLegend(void);
 void drawColorbar(vector<trans_t> colors, vector<coord_t> coords, attribute_t type);
 void drawShapedata(int fileNum);
+int shapeLevelOfDetail(void);
+void simplifyPolyline(const float *coords, int numPoints, float tolerance, vector<float> &result);
+void buildShapeBatch(int fileNum);
+void initShapeBuffers(void);
 coord_t screen2worldCoords(int screenX, int screenY, float worldZ);
 coord_t points2vector(coord_t a, coord_t b);
 double calcDistance(float x1, float y1, float x2, float y2);
 void calcSliceSteps(void);
-void solve4x4Lapack(double *a, double *b);
-void interpolateSliceGraph(float *sliceData, int sdsize);
-bool insideCell(float x, float y, int &i);
+void bilinearWeights(float x, float y, int index, float *w);
+void interpolateSliceGraph(float *sliceData, int sdsize, const float *values);
+void updateSliceTable(void);
+const float *getSliceData(int attr, int timeStep);
+void updateSliceWindow(void);
+float interpolateCell(const float *values, int index, const float *w);
+void orderSliceLine(void);
+void computeSliceLegend(void);
+void computeHovmoller(void);
+bool updateHovmollerColors(void);
+int hovmollerRowStride(void);
+void drawHovmoller(void);
+void openFetch(fetchstate_t &fetch);
+void closeFetch(fetchstate_t &fetch);
+const float *fetchTimeStep(int attr, int timeStep, fetchstate_t &fetch);
+bool openStreamFile(int fileNum, fetchstate_t &fetch);
 bool findFirstCell(float x, float y, int &index);
-bool nextInterpolationPoint(float x, float y, int &index, int level);
+bool pointInCell(float x, float y, int index);
+void buildCellIndex(void);
+void cellBinRange(float lo, float hi, float origin, float size, int numBins, int &first, int &last);
+bool walkToCell(float x, float y, int &index);
+void traceSliceCells(int *cells, int sdsize);
+bool readNcVar(NcFile *ncF, const char *name, long firstRec, long numRecs,
+		int firstRow, int blockRows, int firstCol, int blockCols, float *dest);
+void addRecords(float *dest, const float *src, long size);
+bool readNcArea(NcFile *ncF, int fileNum, long firstRec, long numRecs,
+		int firstRow, int blockRows, int firstCol, int blockCols, float **attrs, float *scratch);
+bool readNcRecords(NcFile *ncF, int fileNum, long firstRec, long numRecs,
+		float *snowpack, float *snowfall, float *precipitation, float *runoff, float *scratch);
+typedef bool (*ncfilework_t)(int fileNum, char **fileList, float *fileMins, float *fileMaxs, float *buffer);
+void *sharedAlloc(size_t size);
+void runIngestWorkers(ncfilework_t work, long bufferSize, char **fileList,
+		float *fileMins, float *fileMaxs, vector<char> &failed);
+pid_t forkIngestWorker(ncfilework_t work, long bufferSize, char **fileList,
+		float *fileMins, float *fileMaxs, int *nextFile, char *status);
+void ingestWorker(ncfilework_t work, long bufferSize, char **fileList,
+		float *fileMins, float *fileMaxs, int *nextFile, char *status);
+bool ingestNcFile(int fileNum, char **fileList, float *fileMins, float *fileMaxs, float *buffer);
+bool scanNcFile(int fileNum, char **fileList, float *fileMins, float *fileMaxs, float *buffer);
+bool getNcFileData(char **fileList);
+unsigned long long ncFileSignature(char **fileList);
+bool loadWeatherCache(char **fileList);
+void writeWeatherCache(char **fileList);
+int dataAttribute(int attrNum);
+float *getTimeStep(int attr, int timeStep);
+void allocateStreamSpace(void);
+void getNcFileStreamData(char **fileList);
+void reduceMinMax(const float *values, const float *prevValues, long size,
+		float &minVal, float &maxVal, float &minDelta, float &maxDelta);
+void reduceMaxsAndMins(float **attrs, float **prevAttrs, long numSteps, float *mins, float *maxs);
+void mergeMaxsAndMins(float *mins, float *maxs, int count);
+void allocateFileMaxsAndMins(float **mins, float **maxs);
+void excludeFileMaxsAndMins(float *mins, float *maxs, int fileNum);
+void freeFileMaxsAndMins(float *mins, float *maxs);
+bool loadStreamStep(int timeStep, fetchstate_t &fetch);
+void finishStreamLoad(int timeStep, bool success);
+void *streamLoader(void *arg);
+void startStreamLoader(void);
+void setStreamPosition(int timeStep, int direction);
+long timeMajorOffset(int point);
+void *buildTimeMajorLayout(void *arg);
+void startTimeMajorBuilder(void);
+bool isTimeMajorReady(void);
+bool findGridPoint(float x, float y, int &point);
+bool getPointTimeSeries(int point, float **series);
+bool getAreaTimeSeries(int firstRow, int lastRow, int firstCol, int lastCol, float **series);
+void readAreaTimeSeries(int firstRow, int lastRow, int firstCol, int lastCol, float **series);
+bool loadProbeSeries(void);
 int getShapeFileData(int fileNum, char *fileName);
-void jpeg2texture(int texNum, char *imageName);
+string shapeCachePath(char *fileName);
+bool shapeFileStat(char *fileName, long long &size, long long &mtime);
+bool loadShapeCache(int fileNum, char *fileName);
+void writeShapeCache(int fileNum, char *fileName);
+bool pointInEntity(const shapedata_t &shapes, int entity, float x, float y);
+float gridCellArea(int point);
+void readRegionNames(void);
+bool buildRegionIndex(void);
+bool computeRegionTotals(int attr);
+void writeRegionCSV(char *fileName);
+void jpegErrorExit(j_common_ptr cinfo);
+bool decodeJPEG(char *imageName, unsigned char *&pixels, int &width, int &height);
+bool writeTileJPEG(const char *fileName, const unsigned char *pixels, int rowPixels,
+		int x0, int y0, int width, int height);
+string tilePath(const mapimage_t &image, int level, int row, int col);
+string fallbackPyramidDir(const char *fileName);
+bool readPyramidIndex(mapimage_t &image, const string &dir, const struct stat &st);
+bool buildImagePyramid(int imageNum);
+void *tileLoader(void *arg);
+void startTileLoaders(void);
+void requestTiles(const vector<tilekey_t> &wanted);
+int uploadDecodedTiles(void);
+bool tilesPending(void);
+void evictTiles(void);
+int tileLevel(const mapimage_t &image, float imageWidth);
+bool drawTile(const tilekey_t &key, float x0, float y0, float x1, float y1);
+void drawMapTiles(void);
 void parseImageLocation(char *fileName);
-void computeColors(GLubyte *weatherColors, int wcsize, float *data, int dataSize);
-void computeDailyColors(GLubyte *weatherColors, int wcsize, float *data, int dataSize);
-void computeSliceCoords(float *sliceCoords, int cosize, float *sliceData, float *prevSliceData);
+bool updateWeatherColors(void);
+void initWeatherBuffers(void);
+void drawWeatherGrid(void);
+void computeColors(GLubyte *weatherColors, int wcsize, const float *values);
+void computeSliceLineColors(GLubyte *sliceColors, int scsize, const float *sliceData);
+void computeDailyColors(GLubyte *weatherColors, int wcsize, const float *values, const float *prevValues);
+void computeSliceCoords(float *sliceCoords, int cosize, const float *sliceData, const float *prevSliceData);
 void allocateWeatherDataSpace(NcFile *ncF);
 void precomputeWeatherParameters(NcFile *ncF);
-void computeMaxsAndMins(void);
+void precomputeGridParameters(void);
 void parseCSVfiles(char *locFileName, char *dataFileName);
+char *mapCSVFile(char *fileName, size_t &size);
+const char *nextCSVLine(const char *p, const char *end, const char *&lineEnd);
+void splitCSVLine(const char *line, const char *lineEnd, vector< pair<const char *, const char *> > &fields);
+bool parseCSVFloat(const char *begin, const char *end, float &value);
+int findCSVColumn(const vector< pair<const char *, const char *> > &header, const char *name, int fallback);
 void parseTransferFile(char *fileName);
+void interpolateTransfer(float val, GLubyte &R, GLubyte &G, GLubyte &B);
+void buildTransferLUT(void);
+void setTransferLUTAlpha(GLubyte alpha);
+int transferLUTIndex(float val);
 lineloc_t aboveOrBelowLine(coord_t a, coord_t b, coord_t c);
 void setTrans(trans_t &t, GLubyte R, GLubyte G, GLubyte B);
 void setTrans(trans_t &t, GLubyte R, GLubyte G, GLubyte B, float val);
@@ -329,6 +870,16 @@ void setCoord(coord_t &c, float x, float y, float z);
 void setCoord(coord_t &c, float x, float y, float z, int val);
 void unreachable(char *funcName);
 void cleanUpMemory(void);
+bool writePNG(const char *fileName, const unsigned char *pixels, int width, int height);
+void *frameEncoder(void *arg);
+void startFrameEncoders(void);
+void queueFrame(captureframe_t &frame);
+void queueCapturedPBO(int pbo);
+void captureFrame(const char *fileName);
+void finishCapture(void);
+bool initHeadlessContext(void);
+double wallTime(void);
+void renderHeadless(void);
 
 void reshape(int w, int h) {
 	// prevent a divide by zero error
@@ -370,6 +921,23 @@ void reshape2(int w, int h) {
 	return;
 }
 
+void reshape3(int w, int h) {
+	// prevent a divide by zero error
+	if (h == 0) h = 1;
+
+	glViewport(0, 0, w, h);
+	glMatrixMode(GL_PROJECTION);
+	glLoadIdentity();
+	// leave room for the axis labels and the legend
+	gluOrtho2D(-70.0, PROBE_GRAPH_WIDTH + 20.0, -40.0, PROBE_GRAPH_HEIGHT + 30.0);
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+
+	screenWidth3 = w;
+	screenHeight3 = h;
+	return;
+}
+
 // zoom more slowly closer to the map
 void zoom(int direction) {
 	if (eye[2] > 10) eye[2] += direction;
@@ -401,18 +969,28 @@ void move(char direction) {
 }
 
 void animate(void) {
+	// background tiles show up as they finish decoding
+	uploadDecodedTiles();
+
+	// a probe made while the time-major layout was being built
+	if (probePending && isTimeMajorReady()) {
+		probePending = !loadProbeSeries();
+		if (probeWindow != -1) glutPostWindowRedisplay(probeWindow);
+	}
+
 	if (running) {
-		currentTimeStep++;
+		currentTimeStep += playbackDirection;
 		// reset the currentTimeStep when it reaches the end
-		if (currentTimeStep > totalTimeSteps) currentTimeStep = 0;
+		if (currentTimeStep >= totalTimeSteps) currentTimeStep = 0;
+		else if (currentTimeStep < 0) currentTimeStep = totalTimeSteps - 1;
+		// tell the loader where to prefetch next
+		if (streaming) setStreamPosition(currentTimeStep, playbackDirection);
 		#ifdef DEBUG2
 		cout << "current time step: " << currentTimeStep << endl;
 		if (currentTimeStep % 100 == 0) cout << currentTimeStep << endl;
 		#endif
 		// used to output a series of images that can be made into a movie
 		if (saving) {
-			// take a screen shot of the window
-			ilutGLScreen();
 			stringstream ss;
 			ss << "image";
 			ss.fill('0');
@@ -422,7 +1000,8 @@ void animate(void) {
 			#ifdef CONSOLE_OUTPUT
 			printf("Saving %s\n", ss.str().c_str());
 			#endif
-			ilSave(IL_PNG, ss.str().c_str());
+			// redraw() captures it once it's drawn
+			captureRequest = ss.str().c_str();
 			// stop saving images if we've reached the end of the animation
 			if (currentTimeStep < imageNo) saving = false;
 		}
@@ -439,41 +1018,58 @@ void key(unsigned char key, int x, int y) {
 		// 1-8 change the current weather attribute
 		case '1':
 			weatherAttrNum = SNOWPACK;
-			weatherData = snowpackData;
 			break;
 		case '2':
 			weatherAttrNum = SNOWFALL;
-			weatherData = snowfallData;
 			break;
 		case '3':
 			weatherAttrNum = PRECIPITATION;
-			weatherData = precipitationData;
 			break;
 		case '4':
 			weatherAttrNum = RUNOFF;
-			weatherData = runoffData;
 			break;
 		case '5':
 			weatherAttrNum = SNOWPACK_DAILY;
-			weatherData = snowpackData;
 			break;
 		case '6':
 			weatherAttrNum = SNOWFALL_DAILY;
-			weatherData = snowfallData;
 			break;
 		case '7':
 			weatherAttrNum = PRECIPITATION_DAILY;
-			weatherData = precipitationData;
 			break;
 		case '8':
 			weatherAttrNum = RUNOFF_DAILY;
-			weatherData = runoffData;
+			break;
+		case '9':
+			if (observedData == NULL) computeObservedSnowpack();
+			if (observedData != NULL) weatherAttrNum = OBSERVED_SNOWPACK;
+			break;
+		case 'a':
+			// totals of the current attribute over every region
+			if (computeRegionTotals(dataAttribute(weatherAttrNum))) writeRegionCSV(regionPath);
+			break;
+		case 'b':
+			// play the simulation backwards
+			playbackDirection = -playbackDirection;
+			if (streaming) setStreamPosition(currentTimeStep, playbackDirection);
 			break;
 		case 'd':
 			shouldDrawStations = !shouldDrawStations;
 			break;
+		case 'v':
+			shouldDrawValidation = !shouldDrawValidation;
+			if (shouldDrawValidation && !validationDone) {
+				computeValidation();
+				writeValidationCSV(validationPath);
+			}
+			break;
+		case 'h':
+			hovmollerMode = !hovmollerMode;
+			break;
 		case 'i':
 			saving = !saving;
+			// write out the frames still in flight
+			if (!saving) finishCapture();
 			break;
 		case 'l':
 			shouldDrawShapes = !shouldDrawShapes;
@@ -489,6 +1085,7 @@ void key(unsigned char key, int x, int y) {
 		case 'r':
 			currentTimeStep = 0;
 			imageNo = 0;
+			if (streaming) setStreamPosition(currentTimeStep, playbackDirection);
 			break;
 		case 's':
 			running = !running;
@@ -554,6 +1151,9 @@ void motion(int x, int y) {
 		lineEnd.y = world.y;
 
 	}
+	else if (probing) {
+		probe(x, y, true);
+	}
 	else if (draggingMap) {
 		world = screen2worldCoords(x, y, 0.0);
 		printf("wx = %f wy = %f\n", world.x, world.y);
@@ -657,6 +1257,12 @@ void mouse(int button, int state, int x, int y) {
 		}
 	}
 	// */
+	else if (button == GLUT_RIGHT_BUTTON) {
+		probing = (state == GLUT_DOWN);
+		// shift averages over the area around the point, kept for the whole drag
+		if (probing) probeArea = (glutGetModifiers() & GLUT_ACTIVE_SHIFT) != 0;
+		if (probing) probe(x, y, false);
+	}
 	else if (button == 3 && state == 0) {
 		zoom(-1);
 	}
@@ -680,7 +1286,7 @@ void redraw(void) {
 	printf("currentTimeStep = %d\n", currentTimeStep);
 	#endif
 
-	glutSetWindow(mainWindow);
+	if (!headless) glutSetWindow(mainWindow);
 	glDisable(GL_DEPTH_TEST);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
@@ -694,79 +1300,10 @@ void redraw(void) {
 
 	// ****draw the map textures
 	if (shouldDrawTextures) {
-		// scaling factors
-		float sizex = 40.0;
-		float sizey = 50.0;
-
-		for (int i = 0; i < texCoords.size(); i++) {
-			float lowerx = texCoords[i].x;
-			float lowery = texCoords[i].y;
-
-			#ifdef CORRECT_TEX_LOC
-			float correctionX = 0.03;
-			float correctionY = 0.045;
-			#else
-			float correctionX = 0.0;
-			float correctionY = 0.0;
-			#endif
-			
-			glEnable(GL_TEXTURE_2D);
-
-			// select which texture to render
-			glBindTexture(GL_TEXTURE_2D, textures[i]);
-			// draw the textures
-			glBegin(GL_QUADS);
-				// might put each of these statements on separate line
-				glTexCoord2i(0, 0); glVertex3f(lowerx - correctionX, lowery - correctionY, 0.0);
-				glTexCoord2i(0, 1); glVertex3f(lowerx - correctionX, lowery + sizey - correctionY, 0.0);
-				glTexCoord2i(1, 1); glVertex3f(lowerx + sizex - correctionX, lowery + sizey - correctionY, 0.0);
-				glTexCoord2i(1, 0); glVertex3f(lowerx + sizex - correctionX, lowery - correctionY, 0.0);
-			glEnd();
-
-			glDisable(GL_TEXTURE_2D);
-		}
-	}
-
-	int wcsize = 4 * recSize;
-	GLubyte weatherColors[wcsize];
-	// draw weather data
-	if (weatherAttrNum >= ATTR_MIN && weatherAttrNum < 4) {
-		computeColors(weatherColors, wcsize, weatherData, recSize);
-
-		// draw each row separately
-		for (int currRow = 0; currRow < numRows - 1; currRow++) {
-			glEnableClientState(GL_COLOR_ARRAY);
-			glEnableClientState(GL_VERTEX_ARRAY);
-
-			glColorPointer(4, GL_UNSIGNED_BYTE, 0, weatherColors);
-			glVertexPointer(2, GL_FLOAT, 0, &weatherCoords[0]);
-			glDrawElements(GL_TRIANGLE_STRIP, weatherIndices[currRow].size(),
-					GL_UNSIGNED_INT, &weatherIndices[currRow][0]);
-
-			glDisableClientState(GL_COLOR_ARRAY);
-			glDisableClientState(GL_VERTEX_ARRAY);
-		}
+		drawMapTiles();
 	}
-	else if (weatherAttrNum >= 4 && weatherAttrNum <= ATTR_MAX) {
-		computeDailyColors(weatherColors, wcsize, weatherData, recSize);
-
-		// draw each row separately
-		for (int currRow = 0; currRow < numRows - 1; currRow++) {
-			glEnableClientState(GL_COLOR_ARRAY);
-			glEnableClientState(GL_VERTEX_ARRAY);
-
-			glColorPointer(4, GL_UNSIGNED_BYTE, 0, &weatherColors[0]);
-			glVertexPointer(2, GL_FLOAT, 0, &weatherCoords[0]);
-			glDrawElements(GL_TRIANGLE_STRIP, weatherIndices[currRow].size(),
-					GL_UNSIGNED_INT, &weatherIndices[currRow][0]);
 
-			glDisableClientState(GL_COLOR_ARRAY);
-			glDisableClientState(GL_VERTEX_ARRAY);
-		}
-	}
-	else {
-		unreachable("redraw");
-	}
+	drawWeatherGrid();
 
 	#ifdef DEBUG2
 	// ****draw weather bounding box
@@ -825,10 +1362,15 @@ void redraw(void) {
 		drawStations(day);
 	}
 
+	// ****draw how well the model matches each station
+	if (shouldDrawValidation) {
+		drawValidation();
+	}
+
 	// ****draw shape data for all files
 	if (shouldDrawShapes) {
 		glLineWidth(1.0);
-		for (int i = 0; i < shapeCoords.size(); i++) {
+		for (int i = 0; i < shapeFiles.size(); i++) {
 			drawShapedata(i);
 		}
 	}
@@ -883,11 +1425,21 @@ void redraw(void) {
 
 	// draw the transfer legend and colorbar
 	drawTransferLegend();
+
+	updateSliceWindow();
+	updateProbeWindow();
 	
 	// reset color and line size
 	glColor3ub(255, 255, 255);
 	glLineWidth(1.0);
-	glutSwapBuffers();
+	// a frame animate() asked to save, read before the buffers swap
+	if (!captureRequest.empty()) {
+		captureFrame(captureRequest.c_str());
+		captureRequest.clear();
+		if (!saving) finishCapture();
+	}
+	// the pbuffer is read back by renderHeadless()
+	if (!headless) glutSwapBuffers();
 	return;
 }
 
@@ -899,16 +1451,30 @@ void redraw2(void) {
 	int scsize = 4 * totalSliceSteps;
 	GLubyte sliceColors[scsize];
 
-	float sliceData[totalSliceSteps];
-	float prevSliceData[totalSliceSteps];
-	interpolateSliceGraph(sliceData, totalSliceSteps);
+	// the slices come out of the cache, so playing forward only interpolates
+	// one new timestep per frame even in daily mode
+	const float *sliceData = NULL, *prevSliceData = NULL;
+	int attr = dataAttribute(weatherAttrNum);
+	if (!hovmollerMode) {
+		sliceData = getSliceData(attr, currentTimeStep);
+		if (isDailyAttribute(weatherAttrNum) && currentTimeStep > 0) {
+			prevSliceData = getSliceData(attr, currentTimeStep - 1);
+		}
+	}
 
 	int cosize = 2 * totalSliceSteps;
 	float sliceCoords[cosize];
 
+	// draw the slice at every timestep
+	if (hovmollerMode) {
+		drawHovmoller();
+	}
+	// nothing to draw for a line shorter than a pixel
+	else if (sliceData == NULL) {
+	}
 	// draw the slice data
-	if (weatherAttrNum >= ATTR_MIN && weatherAttrNum < 4) {
-		computeColors(sliceColors, scsize, sliceData, totalSliceSteps);
+	else if (!isDailyAttribute(weatherAttrNum)) {
+		computeSliceLineColors(sliceColors, scsize, sliceData);
 		computeSliceCoords(sliceCoords, cosize, sliceData, prevSliceData);
 
 		glEnableClientState(GL_COLOR_ARRAY);
@@ -921,18 +1487,12 @@ void redraw2(void) {
 		glDisableClientState(GL_COLOR_ARRAY);
 		glDisableClientState(GL_VERTEX_ARRAY);
 	}
-	else if (weatherAttrNum >= 4 && weatherAttrNum <= ATTR_MAX) {
-		if (currentTimeStep == 0) {
-			for (int i = 0; i < totalSliceSteps; i++) {
-				prevSliceData[i] = 0.0;
-			}
-		}
-		else {
-			currentTimeStep -= 1;
-			interpolateSliceGraph(prevSliceData, totalSliceSteps);
-			currentTimeStep += 1;
-		}
-		computeDailyColors(sliceColors, scsize, sliceData, totalSliceSteps);
+	else if (isDailyAttribute(weatherAttrNum)) {
+		#ifdef SLICE_COLOR_ON
+		computeDailyColors(sliceColors, scsize, sliceData, prevSliceData);
+		#else
+		computeSliceLineColors(sliceColors, scsize, sliceData);
+		#endif
 		computeSliceCoords(sliceCoords, cosize, sliceData, prevSliceData);
 
 		glEnableClientState(GL_COLOR_ARRAY);
@@ -968,8 +1528,16 @@ void redraw2(void) {
 
 		float xLoc = -50.0;
 		float yOffset = 5.0;
+		// draw days
+		if (hovmollerMode) {
+			char day[20];
+			int samplesPerDay = HOURS_PER_DAY / 3;
+			snprintf(day, 19, "day %d", (int)(totalTimeSteps * (i / SLICE_GRAPH_HEIGHT)) / samplesPerDay);
+			glColor3ub(255, 255, 255);
+			drawBitmapString(xLoc, i - yOffset, 0.0, LITTLE_FONT, day);
+		}
 		// draw values
-		if (i == 0) {
+		else if (i == 0) {
 			drawBitmapString(xLoc, i - yOffset, 0.0, LITTLE_FONT, "MIN");
 		}
 		else if (i == SLICE_GRAPH_HEIGHT) {
@@ -1002,161 +1570,970 @@ void redraw2(void) {
 	}
 	
 	glutSwapBuffers();
-	glutPostRedisplay();
 	return;
 }
 
-void drawBitmapString(float x, float y, float z, void *font, char *string) {
-    char *c;
-    glRasterPos3f(x, y, z);
-    for (c = string; *c != '\0'; c++) {
-        glutBitmapCharacter(font, *c);
-    }
+// Picks the grid point under the mouse and pulls the series of every attribute
+// there(or around it, see probeArea) out of the time-major layout, see
+// getAreaTimeSeries(). following is true while dragging.
+void probe(int x, int y, bool following) {
+	// in streaming mode every query opens every Ncfile, so don't follow the mouse
+	if (following && streaming) return;
+
+	coord_t world = screen2worldCoords(x, y, 0.0);
+	int point;
+	if (!findGridPoint(world.x, world.y, point)) return;
+	if (point == probePoint && probeArea == probeSeriesArea) return;
+
+	probePoint = point;
+	probeSeriesArea = probeArea;
+	// animate() tries again once the layout is built
+	probePending = !loadProbeSeries();
+
+	// only do this once
+	if (probeWindow == -1) {
+		int win = glutGetWindow();
+		glutInitWindowSize(screenWidth3, screenHeight3);
+		probeWindow = glutCreateWindow("Weather Probe");
+		glutPositionWindow(screenWidth2 + 20, screenHeight + 80);
+		glutDisplayFunc(redraw3);
+		glutReshapeFunc(reshape3);
+		glutSetWindow(win);
+	}
+	else glutPostWindowRedisplay(probeWindow);
 	return;
 }
 
-void drawTriangle(coord_t center, float size) {
-    glBegin(GL_LINE_LOOP);
-		glVertex3f(center.x, center.y + size, center.z);
-		glVertex3f(center.x - size, center.y - size, center.z);
-		glVertex3f(center.x + size, center.y - size, center.z);
-    glEnd();
-    return;
+// Fills probeSeries for probePoint. Returns false, with probeSeries empty,
+// while the time-major layout is still being built.
+bool loadProbeSeries(void) {
+	float *series[4];
+	for (int attr = 0; attr < 4; attr++) {
+		probeSeries[attr].resize(totalTimeSteps);
+		series[attr] = &probeSeries[attr][0];
+	}
+
+	bool loaded;
+	if (probeSeriesArea) {
+		int row = probePoint / numCols, col = probePoint % numCols;
+		loaded = getAreaTimeSeries(row - PROBE_AREA_RADIUS, row + PROBE_AREA_RADIUS,
+				col - PROBE_AREA_RADIUS, col + PROBE_AREA_RADIUS, series);
+	}
+	else loaded = getPointTimeSeries(probePoint, series);
+
+	if (!loaded) {
+		for (int attr = 0; attr < 4; attr++) probeSeries[attr].clear();
+	}
+	return loaded;
 }
 
-void drawX(coord_t center, float size) {
-	glBegin(GL_LINES);
-		glVertex3f(center.x - size, center.y + size, center.z);
-		glVertex3f(center.x + size, center.y - size, center.z);
-		glVertex3f(center.x + size, center.y + size, center.z);
-		glVertex3f(center.x - size, center.y - size, center.z);
-	glEnd();
+// posts a redisplay of the probe window if the point or the timestep changed
+void updateProbeWindow(void) {
+	if (probeWindow == -1) return;
+	if (probeWindowPoint == probePoint && probeWindowTimeStep == currentTimeStep) return;
+	glutPostWindowRedisplay(probeWindow);
 	return;
 }
 
-void drawStations(int day) {
-	#ifdef DEBUG2
-	printf("currentTimeStep = %d day = %d\n", currentTimeStep, day);
-	#endif
+// plots every attribute at the probed point over the whole run, each scaled
+// to its own max
+void redraw3(void) {
+	glutSetWindow(probeWindow);
+	glDisable(GL_DEPTH_TEST);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
-	// stay in the limits
-	if (day > 365) {
-		//cerr << "Error: Day was out of bounds" << endl;
-		// may need to change this depending on desired behavior
-		currentTimeStep = 0;
-		return;
-	}
+	probeWindowPoint = probePoint;
+	probeWindowTimeStep = currentTimeStep;
 
-	// size of the station data triangles
-	float stationSize = 0.025;
+	char *names[4] = {"Snowpack", "Snowfall", "Precipitation", "Runoff"};
+	GLubyte colors[4][3] = {{255, 255, 255}, {0, 200, 255}, {0, 255, 0}, {255, 160, 0}};
+	float xScale = PROBE_GRAPH_WIDTH / max(totalTimeSteps - 1, 1);
 
-	for (int stationNum = 0; stationNum < csvCoords.size(); stationNum++) {
-		// normalize the data
-		float val = csvData[day][stationNum];
-		int tSize = transFuncData.size();
-		GLubyte newRed, newGreen, newBlue;
+	glLineWidth(1.0);
+	for (int attr = 0; attr < 4; attr++) {
+		if (probeSeries[attr].size() != totalTimeSteps) continue;
 
-		// check if the value is outside the bounds of the transfer function
-		if (val <= transFuncData[0].value) {
-			newRed = transFuncData[0].R;
-			newGreen = transFuncData[0].G;
-			newBlue = transFuncData[0].B;
-		}
-		else if (val >= transFuncData[tSize - 1].value) {
-			newRed = transFuncData[tSize - 1].R;
-			newGreen = transFuncData[tSize - 1].G;
-			newBlue = transFuncData[tSize - 1].B;
+		float attrMax = weatherAttrMax[attr];
+		float yScale = (attrMax > 0.0) ? PROBE_GRAPH_HEIGHT / attrMax : 0.0;
+
+		glColor3ubv(colors[attr]);
+		glBegin(GL_LINE_STRIP);
+		for (int timeStep = 0; timeStep < totalTimeSteps; timeStep++) {
+			glVertex2f(timeStep * xScale, probeSeries[attr][timeStep] * yScale);
 		}
-		else {
-			// calculate the color using transfer function
-			int colorIndex;
-			// find which interval this value lies in
-			for(colorIndex = 0; colorIndex < tSize; colorIndex++) {
-				if (transFuncData[colorIndex].value > val) break;
-			}
+		glEnd();
 
-			// calculate lower color data
-			float lowVal = transFuncData[colorIndex - 1].value;
-			GLubyte red1 = transFuncData[colorIndex - 1].R;
-			GLubyte green1 = transFuncData[colorIndex - 1].G;
-			GLubyte blue1 = transFuncData[colorIndex - 1].B;
+		// legend
+		drawBitmapString(10.0 + attr * 120.0, PROBE_GRAPH_HEIGHT + 10.0, 0.0, LITTLE_FONT, names[attr]);
+	}
 
-			// calculate upper color data
-			float highVal = transFuncData[colorIndex].value;
-			GLubyte red2 = transFuncData[colorIndex].R;
-			GLubyte green2 = transFuncData[colorIndex].G;
-			GLubyte blue2 = transFuncData[colorIndex].B;
+	// mark the current timestep
+	glColor3f(0.54, 0.16, 0.88);
+	glLineWidth(3.0);
+	glBegin(GL_LINES);
+		glVertex2f(currentTimeStep * xScale, 0.0);
+		glVertex2f(currentTimeStep * xScale, PROBE_GRAPH_HEIGHT);
+	glEnd();
+	glLineWidth(1.0);
 
-			float diff = highVal - lowVal;
+	// draw an outline around the data
+	glColor3ub(255, 255, 255);
+	glBegin(GL_LINE_LOOP);
+		glVertex2f(0.0, 0.0);
+		glVertex2f(PROBE_GRAPH_WIDTH, 0.0);
+		glVertex2f(PROBE_GRAPH_WIDTH, PROBE_GRAPH_HEIGHT);
+		glVertex2f(0.0, PROBE_GRAPH_HEIGHT);
+	glEnd();
 
-			// linearly interpolate the new color
-			newRed = (1.0 - ((val - lowVal)/diff))*red1 + (1.0 - ((highVal - val)/diff))*red2;
-			newGreen = (1.0 - ((val - lowVal)/diff))*green1 + (1.0 - ((highVal - val)/diff))*green2;
-			newBlue = (1.0 - ((val - lowVal)/diff))*blue1 + (1.0 - ((highVal - val)/diff))*blue2;
-		}
-		
-		coord_t station = csvCoords[stationNum];
-		// draw the stations as triangles
-		glColor4ub(newRed, newGreen, newBlue, transparency);
-		glBegin(GL_TRIANGLES);
-			glVertex3f(station.x, station.y + stationSize, station.z);
-			glVertex3f(station.x - stationSize, station.y - stationSize, station.z);
-			glVertex3f(station.x + stationSize, station.y - stationSize, station.z);
+	// y axis is the fraction of each attribute's max
+	drawBitmapString(-50.0, -5.0, 0.0, LITTLE_FONT, "0");
+	drawBitmapString(-50.0, PROBE_GRAPH_HEIGHT - 5.0, 0.0, LITTLE_FONT, "MAX");
+
+	// x axis in days
+	int samplesPerDay = HOURS_PER_DAY / 3;
+	for (int i = 0; i <= 8; i++) {
+		float xLoc = i * PROBE_GRAPH_WIDTH / 8.0;
+		char day[20];
+		snprintf(day, 19, "day %d", (int)(i * (totalTimeSteps - 1) / 8.0) / samplesPerDay);
+		glBegin(GL_LINES);
+			glVertex2f(xLoc, 0.0);
+			glVertex2f(xLoc, -10.0);
 		glEnd();
+		drawBitmapString(xLoc - 15.0, -25.0, 0.0, LITTLE_FONT, day);
+	}
 
-		// outline the stations for visability
-		glColor3ub(0, 0, 0);
-		drawTriangle(station, stationSize);
+	if (probePending) {
+		glColor3ub(255, 255, 255);
+		drawBitmapString(PROBE_GRAPH_WIDTH / 2.0 - 120.0, PROBE_GRAPH_HEIGHT / 2.0, 0.0, LITTLE_FONT,
+				"Waiting for the time-major layout to be built...");
+	}
+
+	// where the point is
+	if (probePoint >= 0) {
+		char location[50];
+		snprintf(location, 49, "(%.2f,%.2f)%s", weatherCoords[2 * probePoint],
+				weatherCoords[2 * probePoint + 1], probeSeriesArea ? " 9x9 mean" : "");
+		drawBitmapString(PROBE_GRAPH_WIDTH - 150.0, PROBE_GRAPH_HEIGHT + 10.0, 0.0, LITTLE_FONT, location);
 	}
+
+	glutSwapBuffers();
 	return;
 }
 
-void drawText(int totalDays) {
-	string year = "";
-	char *month;
-	char day[3];
+void drawBitmapString(float x, float y, float z, void *font, char *string) {
+	// GLUT's fonts need GLUT, which needs a display
+	if (headless) return;
+    char *c;
+    glRasterPos3f(x, y, z);
+    for (c = string; *c != '\0'; c++) {
+        glutBitmapCharacter(font, *c);
+    }
+	return;
+}
 
-	// index this at 1, not 0
-	totalDays++;
+// Samples the model snowpack at every station, averaged over each day, and
+// compares it with the station data on the matching DAY. Days are done in
+// parallel, then the stations.
+void computeValidation(void) {
+	int numStations = csvCoords.size();
+	int samplesPerDay = HOURS_PER_DAY / 3;
+	int numModelDays = totalTimeSteps / samplesPerDay;
 
-	if (totalDays < 62) year += ", 2001";
-	else year += ", 2002";
+	// find each station's cell and weights once
+	vector<int> cells(numStations, -1);
+	vector<float> weights(4 * numStations);
+	for (int stationNum = 0; stationNum < numStations; stationNum++) {
+		int index;
+		coord_t station = csvCoords[stationNum];
+		if (!findFirstCell(station.x, station.y, index)) continue;
+		cells[stationNum] = index;
+		bilinearWeights(station.x, station.y, index, &weights[4 * stationNum]);
+	}
 
-	// find the date based on 11-1
-	if (totalDays < 31) {
-		month = "November ";
+	#ifdef CONSOLE_OUTPUT
+	printf("Validating the model at %d stations over %d days.\n", numStations, numModelDays);
+	#endif
+
+	// daily mean of the model at every station, [day][station]
+	vector<float> modelDaily((long)numModelDays * numStations, 0.0);
+
+	#pragma omp parallel
+	{
+	fetchstate_t fetch;
+	openFetch(fetch);
+
+	#pragma omp for schedule(static)
+	for (int day = 0; day < numModelDays; day++) {
+		float *dayMeans = &modelDaily[(long)day * numStations];
+		for (int sample = 0; sample < samplesPerDay; sample++) {
+			const float *values = fetchTimeStep(SNOWPACK, day * samplesPerDay + sample, fetch);
+			if (values == NULL) continue;
+			for (int stationNum = 0; stationNum < numStations; stationNum++) {
+				if (cells[stationNum] < 0) continue;
+				dayMeans[stationNum] += interpolateCell(values, cells[stationNum],
+						&weights[4 * stationNum]) / samplesPerDay;
+			}
+		}
 	}
-	else if (totalDays < 62) {
-		month = "Decemeber ";
-		totalDays -= 30;
+
+	closeFetch(fetch);
 	}
-	else if (totalDays < 93) {
-		month = "January ";
-		totalDays -= 61;
+
+	vector<validsums_t> stationSums(numStations);
+
+	#pragma omp parallel for
+	for (int stationNum = 0; stationNum < numStations; stationNum++) {
+		validsums_t sums = {0, 0.0, 0.0, 0.0, 0.0, 0.0};
+		for (int row = 0; row < numCsvDays && cells[stationNum] >= 0; row++) {
+			// DAY starts at 1
+			int day = csvDays[row] - 1;
+			if (day < 0 || day >= numModelDays) continue;
+			float obs = csvData[(long)row * numCsvStations + stationNum];
+			// missing readings
+			if (obs < 0.0) continue;
+			addValidationSums(sums, modelDaily[(long)day * numStations + stationNum],
+					obs * PILLOW_TO_MODEL_UNITS);
+		}
+		stationSums[stationNum] = sums;
 	}
-	else if (totalDays < 121) {
-		month = "February ";
-		totalDays -= 92;
+
+	validsums_t networkSums = {0, 0.0, 0.0, 0.0, 0.0, 0.0};
+	stationValidation.resize(numStations);
+	for (int stationNum = 0; stationNum < numStations; stationNum++) {
+		const validsums_t &sums = stationSums[stationNum];
+		stationValidation[stationNum] = finishValidation(sums);
+		networkSums.n += sums.n;
+		networkSums.sumModel += sums.sumModel;
+		networkSums.sumObs += sums.sumObs;
+		networkSums.sumModel2 += sums.sumModel2;
+		networkSums.sumObs2 += sums.sumObs2;
+		networkSums.sumModelObs += sums.sumModelObs;
 	}
-	else if (totalDays < 152) {
-		month = "March ";
-		totalDays -= 120;
+	networkValidation = finishValidation(networkSums);
+	validationDone = true;
+
+	#ifdef CONSOLE_OUTPUT
+	printf("Network: bias = %.2f rmse = %.2f correlation = %.3f over %ld station days\n",
+			networkValidation.bias, networkValidation.rmse, networkValidation.correlation,
+			networkValidation.numDays);
+	#endif
+	return;
+}
+
+void addValidationSums(validsums_t &sums, double model, double obs) {
+	sums.n++;
+	sums.sumModel += model;
+	sums.sumObs += obs;
+	sums.sumModel2 += model * model;
+	sums.sumObs2 += obs * obs;
+	sums.sumModelObs += model * obs;
+	return;
+}
+
+// bias and rmse are model - observed, correlation is Pearson's r
+validation_t finishValidation(const validsums_t &sums) {
+	validation_t result = {sums.n, 0.0, 0.0, 0.0};
+	if (sums.n == 0) return result;
+
+	double n = sums.n;
+	result.bias = (sums.sumModel - sums.sumObs) / n;
+	double meanSquare = (sums.sumModel2 - 2.0 * sums.sumModelObs + sums.sumObs2) / n;
+	result.rmse = sqrt(max(meanSquare, 0.0));
+
+	double varModel = n * sums.sumModel2 - sums.sumModel * sums.sumModel;
+	double varObs = n * sums.sumObs2 - sums.sumObs * sums.sumObs;
+	if (varModel > 0.0 && varObs > 0.0) {
+		result.correlation = (n * sums.sumModelObs - sums.sumModel * sums.sumObs) /
+				sqrt(varModel * varObs);
 	}
-	else if (totalDays < 182) {
-		month = "April ";
-		totalDays -= 151;
+	return result;
+}
+
+void writeValidationCSV(char *fileName) {
+	FILE *fout = fopen(fileName, "w");
+	if (fout == NULL) {
+		#ifndef ERROR_NOTIFICATION_OFF
+		fprintf(stderr, "Error: Couldn't write %s.\n", fileName);
+		#endif
+		return;
 	}
-	else if (totalDays < 213) {
-		month = "May ";
-		totalDays -= 181;
+
+	fprintf(fout, "ID,Lat,Lon,Days,Bias,RMSE,Correlation\n");
+	for (int stationNum = 0; stationNum < stationValidation.size(); stationNum++) {
+		const validation_t &v = stationValidation[stationNum];
+		string name = (stationNum < csvNames.size()) ? csvNames[stationNum] : "";
+		fprintf(fout, "%s,%.3f,%.3f,%ld,%.3f,%.3f,%.4f\n", name.c_str(),
+				csvCoords[stationNum].y, csvCoords[stationNum].x,
+				v.numDays, v.bias, v.rmse, v.correlation);
 	}
-	else if (totalDays < 243) {
-		month = "June ";
-		totalDays -= 212;
+	fprintf(fout, "NETWORK,,,%ld,%.3f,%.3f,%.4f\n", networkValidation.numDays,
+			networkValidation.bias, networkValidation.rmse, networkValidation.correlation);
+	fclose(fout);
+
+	#ifdef CONSOLE_OUTPUT
+	printf("Wrote %s.\n", fileName);
+	#endif
+	return;
+}
+
+// buckets the stations that have a location into about one per bin
+void buildStationIndex(void) {
+	int numStations = csvCoords.size();
+	if (numStations == 0) return;
+
+	float sxMin = MAX_FLOAT, sxMax = -MAX_FLOAT, syMin = MAX_FLOAT, syMax = -MAX_FLOAT;
+	for (int stationNum = 0; stationNum < numStations; stationNum++) {
+		sxMin = min(sxMin, csvCoords[stationNum].x);
+		sxMax = max(sxMax, csvCoords[stationNum].x);
+		syMin = min(syMin, csvCoords[stationNum].y);
+		syMax = max(syMax, csvCoords[stationNum].y);
 	}
-	else if (totalDays < 274) {
-		month = "July ";
-		totalDays -= 242;
+
+	// square bins, so the ring search below covers a circle evenly
+	float area = max((sxMax - sxMin) * (syMax - syMin), 1e-6f);
+	stationBinSize = max(sqrt(area / numStations), 1e-3f);
+	stationBinX = sxMin;
+	stationBinY = syMin;
+	stationBinCols = (int)((sxMax - sxMin) / stationBinSize) + 1;
+	stationBinRows = (int)((syMax - syMin) / stationBinSize) + 1;
+
+	int numBins = stationBinCols * stationBinRows;
+	vector<int>(numBins + 1, 0).swap(stationBinStart);
+	vector<int>(numStations).swap(stationBinStations);
+	vector<int> bins(numStations);
+	for (int stationNum = 0; stationNum < numStations; stationNum++) {
+		int col = (int)((csvCoords[stationNum].x - stationBinX) / stationBinSize);
+		int row = (int)((csvCoords[stationNum].y - stationBinY) / stationBinSize);
+		bins[stationNum] = min(row, stationBinRows - 1) * stationBinCols + min(col, stationBinCols - 1);
+		stationBinStart[bins[stationNum] + 1]++;
+	}
+	// turn the counts into offsets
+	for (int b = 0; b < numBins; b++) stationBinStart[b + 1] += stationBinStart[b];
+	vector<int> counts(numBins, 0);
+	for (int stationNum = 0; stationNum < numStations; stationNum++) {
+		int b = bins[stationNum];
+		stationBinStations[stationBinStart[b] + counts[b]++] = stationNum;
+	}
+	return;
+}
+
+// Finds the k stations closest to (x,y), closest first. Rings of bins are
+// searched outward until no unsearched bin can hold anything closer.
+// Returns how many were found.
+int findNearestStations(float x, float y, int k, int *nearest, float *dist) {
+	int found = 0;
+	if (stationBinCols == 0) return 0;
+
+	int col = (int)floor((x - stationBinX) / stationBinSize);
+	int row = (int)floor((y - stationBinY) / stationBinSize);
+	int maxRing = max(stationBinCols, stationBinRows) + abs(col) + abs(row);
+
+	for (int ring = 0; ring <= maxRing; ring++) {
+		// every bin outside this ring is at least this far away
+		if (found == k && dist[k - 1] <= (ring - 1) * stationBinSize) break;
+
+		for (int r = row - ring; r <= row + ring; r++) {
+			if (r < 0 || r >= stationBinRows) continue;
+			for (int c = col - ring; c <= col + ring; c++) {
+				if (c < 0 || c >= stationBinCols) continue;
+				// only the edge of the ring is new
+				if (abs(r - row) != ring && abs(c - col) != ring) continue;
+
+				int b = r * stationBinCols + c;
+				for (int i = stationBinStart[b]; i < stationBinStart[b + 1]; i++) {
+					int stationNum = stationBinStations[i];
+					float d = calcDistance(x, y, csvCoords[stationNum].x, csvCoords[stationNum].y);
+					if (found == k && d >= dist[k - 1]) continue;
+
+					// insert it in order
+					int j = (found < k) ? found++ : k - 1;
+					while (j > 0 && dist[j - 1] > d) {
+						dist[j] = dist[j - 1];
+						nearest[j] = nearest[j - 1];
+						j--;
+					}
+					dist[j] = d;
+					nearest[j] = stationNum;
+				}
+			}
+		}
+	}
+	return found;
+}
+
+// inverse distance weighted average of the n stations in nearest
+float idwValue(const float *obs, const int *nearest, const float *dist, int n) {
+	double sum = 0.0, weightSum = 0.0;
+	for (int i = 0; i < n; i++) {
+		// right on top of a station
+		if (dist[i] < 1e-6) return obs[nearest[i]];
+		double weight = 1.0 / pow((double)dist[i], (double)IDW_POWER);
+		sum += weight * obs[nearest[i]];
+		weightSum += weight;
+	}
+	return (weightSum > 0.0) ? sum / weightSum : 0.0;
+}
+
+// Ordinary kriging of the n stations in nearest with an exponential variogram.
+// Falls back to idwValue() if the system can't be solved.
+float krigingValue(const float *obs, const int *nearest, const float *dist, int n, float sill) {
+	if (n < 2 || sill <= 0.0) return idwValue(obs, nearest, dist, n);
+
+	// [gamma(d_ij) 1; 1 0] [w; mu] = [gamma(d_i0); 1]
+	int size = n + 1;
+	double a[(IDW_NEIGHBORS + 1) * (IDW_NEIGHBORS + 1)], b[IDW_NEIGHBORS + 1];
+	for (int i = 0; i < n; i++) {
+		coord_t si = csvCoords[nearest[i]];
+		for (int j = 0; j < n; j++) {
+			coord_t sj = csvCoords[nearest[j]];
+			double h = calcDistance(si.x, si.y, sj.x, sj.y);
+			a[i * size + j] = sill * (1.0 - exp(-3.0 * h / KRIGING_RANGE));
+		}
+		a[i * size + n] = 1.0;
+		a[n * size + i] = 1.0;
+		b[i] = sill * (1.0 - exp(-3.0 * dist[i] / KRIGING_RANGE));
+	}
+	a[n * size + n] = 0.0;
+	b[n] = 1.0;
+
+	if (!solveLinearSystem(a, b, size)) return idwValue(obs, nearest, dist, n);
+
+	double value = 0.0;
+	for (int i = 0; i < n; i++) value += b[i] * obs[nearest[i]];
+	// the weights can be negative, but snow can't
+	return (value > 0.0) ? value : 0.0;
+}
+
+// Gaussian elimination with partial pivoting on the row major n x n matrix a.
+// The solution replaces b. Returns false if a is singular.
+bool solveLinearSystem(double *a, double *b, int n) {
+	for (int col = 0; col < n; col++) {
+		int pivot = col;
+		for (int row = col + 1; row < n; row++) {
+			if (fabs(a[row * n + col]) > fabs(a[pivot * n + col])) pivot = row;
+		}
+		if (fabs(a[pivot * n + col]) < 1e-12) return false;
+		if (pivot != col) {
+			for (int k = 0; k < n; k++) swap(a[col * n + k], a[pivot * n + k]);
+			swap(b[col], b[pivot]);
+		}
+		for (int row = col + 1; row < n; row++) {
+			double factor = a[row * n + col] / a[col * n + col];
+			for (int k = col; k < n; k++) a[row * n + k] -= factor * a[col * n + k];
+			b[row] -= factor * b[col];
+		}
+	}
+	for (int row = n - 1; row >= 0; row--) {
+		for (int k = row + 1; k < n; k++) b[row] -= a[row * n + k] * b[k];
+		b[row] /= a[row * n + row];
+	}
+	return true;
+}
+
+// Interpolates the station data onto every grid point for every day of the
+// simulation. Each point's nearest stations are found once through the
+// station index, then the days are done in parallel, skipping stations
+// without a reading that day.
+void computeObservedSnowpack(void) {
+	int numStations = csvCoords.size();
+	int samplesPerDay = HOURS_PER_DAY / 3;
+	numObservedDays = (totalTimeSteps + samplesPerDay - 1) / samplesPerDay;
+	if (numStations == 0 || numObservedDays == 0) {
+		#ifndef ERROR_NOTIFICATION_OFF
+		fprintf(stderr, "Error: There's no station data to interpolate.\n");
+		#endif
+		return;
+	}
+
+	buildStationIndex();
+
+	#ifdef CONSOLE_OUTPUT
+	printf("Interpolating %d stations onto the grid for %d days.\n", numStations, numObservedDays);
+	#endif
+
+	// the nearest stations of every grid point
+	vector<int> candidates((long)recSize * IDW_CANDIDATES);
+	vector<float> candidateDist((long)recSize * IDW_CANDIDATES);
+	vector<int> numCandidates(recSize);
+	#pragma omp parallel for
+	for (long i = 0; i < recSize; i++) {
+		numCandidates[i] = findNearestStations(weatherCoords[2 * i], weatherCoords[2 * i + 1],
+				IDW_CANDIDATES, &candidates[i * IDW_CANDIDATES], &candidateDist[i * IDW_CANDIDATES]);
+	}
+
+	// the row of station data for each day, DAY starts at 1
+	vector<int> dayRow(numObservedDays, -1);
+	for (int row = 0; row < numCsvDays; row++) {
+		int day = csvDays[row] - 1;
+		if (day >= 0 && day < numObservedDays) dayRow[day] = row;
+	}
+
+	observedData = new float[(long)numObservedDays * recSize];
+	float observedMin = MAX_FLOAT, observedMax = -MAX_FLOAT;
+
+	#pragma omp parallel
+	{
+	vector<float> obs(numStations);
+	float dayMin = MAX_FLOAT, dayMax = -MAX_FLOAT;
+
+	#pragma omp for schedule(dynamic, 1)
+	for (int day = 0; day < numObservedDays; day++) {
+		float *field = observedData + (long)day * recSize;
+		if (dayRow[day] < 0) {
+			memset(field, 0, recSize * sizeof(float));
+			continue;
+		}
+
+		// this day's readings in model units
+		for (int stationNum = 0; stationNum < numStations; stationNum++) {
+			float value = csvData[(long)dayRow[day] * numCsvStations + stationNum];
+			obs[stationNum] = (value < 0.0) ? CSV_MISSING : value * PILLOW_TO_MODEL_UNITS;
+		}
+
+		#ifdef OBSERVED_KRIGING
+		// and their variance
+		double sum = 0.0, sum2 = 0.0;
+		int numValid = 0;
+		for (int stationNum = 0; stationNum < numStations; stationNum++) {
+			if (obs[stationNum] == CSV_MISSING) continue;
+			sum += obs[stationNum];
+			sum2 += obs[stationNum] * obs[stationNum];
+			numValid++;
+		}
+		float sill = (numValid > 1) ? (sum2 - sum * sum / numValid) / (numValid - 1) : 0.0;
+		#endif
+
+		for (long i = 0; i < recSize; i++) {
+			int nearest[IDW_NEIGHBORS];
+			float dist[IDW_NEIGHBORS];
+			int n = 0;
+			const int *c = &candidates[i * IDW_CANDIDATES];
+			const float *d = &candidateDist[i * IDW_CANDIDATES];
+			for (int k = 0; k < numCandidates[i] && n < IDW_NEIGHBORS; k++) {
+				if (obs[c[k]] == CSV_MISSING) continue;
+				nearest[n] = c[k];
+				dist[n++] = d[k];
+			}
+
+			#ifdef OBSERVED_KRIGING
+			field[i] = krigingValue(&obs[0], nearest, dist, n, sill);
+			#else
+			field[i] = idwValue(&obs[0], nearest, dist, n);
+			#endif
+		}
+
+		for (long i = 0; i < recSize; i++) {
+			if (field[i] < dayMin) dayMin = field[i];
+			if (field[i] > dayMax) dayMax = field[i];
+		}
+	}
+
+	#pragma omp critical
+	{
+	if (dayMin < observedMin) observedMin = dayMin;
+	if (dayMax > observedMax) observedMax = dayMax;
+	}
+	}
+
+	weatherAttrMin[OBSERVED_SNOWPACK] = observedMin;
+	weatherAttrMax[OBSERVED_SNOWPACK] = observedMax;
+	return;
+}
+
+// the day of observed data shown at timeStep
+float *observedTimeStep(int timeStep) {
+	int day = timeStep / (HOURS_PER_DAY / 3);
+	if (day >= numObservedDays) day = numObservedDays - 1;
+	return observedData + (long)day * recSize;
+}
+
+// even-odd test against every part of the entity, so holes are left out
+bool pointInEntity(const shapedata_t &shapes, int entity, float x, float y) {
+	bool inside = false;
+	for (int currPart = shapes.entityStart[entity]; currPart < shapes.entityStart[entity + 1]; currPart++) {
+		int first = shapes.partStart[currPart], last = shapes.partStart[currPart + 1] - 1;
+		for (int i = first, j = last; i <= last; j = i++) {
+			float xi = shapes.coords[2 * i], yi = shapes.coords[2 * i + 1];
+			float xj = shapes.coords[2 * j], yj = shapes.coords[2 * j + 1];
+			if ((yi > y) != (yj > y) && x < xi + (y - yi) * (xj - xi) / (yj - yi)) {
+				inside = !inside;
+			}
+		}
+	}
+	return inside;
+}
+
+// The ground area(m^2) a grid point stands for, the parallelogram spanned by
+// half the distance to its neighbors along the row and along the column.
+float gridCellArea(int point) {
+	int row = point / numCols, col = point % numCols;
+	int left = (col > 0) ? point - 1 : point;
+	int right = (col < numCols - 1) ? point + 1 : point;
+	int below = (row > 0) ? point - numCols : point;
+	int above = (row < numRows - 1) ? point + numCols : point;
+	if (left == right || below == above) return 0.0;
+
+	// central differences inside the grid, one sided on its edges
+	double colSteps = right - left, rowSteps = (above - below) / numCols;
+	double metersPerDegree = EARTH_RADIUS * M_PI / 180.0;
+	double lonScale = cos(weatherCoords[2 * point + 1] * M_PI / 180.0);
+	double ex = (weatherCoords[2 * right] - weatherCoords[2 * left]) / colSteps * lonScale;
+	double ey = (weatherCoords[2 * right + 1] - weatherCoords[2 * left + 1]) / colSteps;
+	double nx = (weatherCoords[2 * above] - weatherCoords[2 * below]) / rowSteps * lonScale;
+	double ny = (weatherCoords[2 * above + 1] - weatherCoords[2 * below + 1]) / rowSteps;
+	return fabs(ex * ny - ey * nx) * metersPerDegree * metersPerDegree;
+}
+
+// Names the regions from the shapefile's .dbf, using the first text field
+// with NAME in its title, or the first text field. Regions without one are numbered.
+void readRegionNames(void) {
+	regionNames.clear();
+	for (int r = 0; r < numRegions; r++) {
+		char name[32];
+		snprintf(name, sizeof(name), "Region %d", r);
+		regionNames.push_back(name);
+	}
+
+	DBFHandle hDBF = DBFOpen(shapeFileNames[regionFileNum].c_str(), "rb");
+	if (hDBF == NULL) return;
+
+	int nameField = -1, textField = -1;
+	for (int field = 0; field < DBFGetFieldCount(hDBF) && nameField == -1; field++) {
+		char title[12];
+		int width, decimals;
+		if (DBFGetFieldInfo(hDBF, field, title, &width, &decimals) != FTString) continue;
+		if (textField == -1) textField = field;
+		for (char *c = title; *c != '\0'; c++) *c = toupper(*c);
+		if (strstr(title, "NAME") != NULL) nameField = field;
+	}
+	if (nameField == -1) nameField = textField;
+
+	if (nameField != -1) {
+		int numRecords = min(DBFGetRecordCount(hDBF), numRegions);
+		for (int r = 0; r < numRecords; r++) {
+			const char *name = DBFReadStringAttribute(hDBF, r, nameField);
+			if (name != NULL && name[0] != '\0') regionNames[r] = name;
+		}
+	}
+	DBFClose(hDBF);
+	return;
+}
+
+// Rasterizes the region shapefile onto the grid once. Grid points are binned
+// so each entity only tests the points inside its bounding box, and the
+// entities are tested in parallel. A point inside more than one entity
+// belongs to the first.
+bool buildRegionIndex(void) {
+	if (regionIndexBuilt) return true;
+	if (regionFileNum < 0 || regionFileNum >= shapeFiles.size()) {
+		#ifndef ERROR_NOTIFICATION_OFF
+		fprintf(stderr, "Error: There's no shapefile %d to take regions from.\n", regionFileNum);
+		#endif
+		return false;
+	}
+	const shapedata_t &shapes = shapeFiles[regionFileNum];
+	numRegions = shapes.numEntities;
+
+	// about four grid points per bin
+	int binCols = max(numCols / 2, 1), binRows = max(numRows / 2, 1);
+	float binWidth = max((xMax - xMin) / binCols, 1e-6f);
+	float binHeight = max((yMax - yMin) / binRows, 1e-6f);
+	vector<int> binStart(binCols * binRows + 1, 0);
+	vector<int> binPoints(recSize);
+	vector<int> pointBin(recSize);
+	for (long i = 0; i < recSize; i++) {
+		int col = min(max((int)((weatherCoords[2 * i] - xMin) / binWidth), 0), binCols - 1);
+		int row = min(max((int)((weatherCoords[2 * i + 1] - yMin) / binHeight), 0), binRows - 1);
+		pointBin[i] = row * binCols + col;
+		binStart[pointBin[i] + 1]++;
+	}
+	for (int b = 0; b < binCols * binRows; b++) binStart[b + 1] += binStart[b];
+	vector<int> counts(binCols * binRows, 0);
+	for (long i = 0; i < recSize; i++) {
+		binPoints[binStart[pointBin[i]] + counts[pointBin[i]]++] = i;
+	}
+
+	#ifdef CONSOLE_OUTPUT
+	printf("Rasterizing %d regions of %s onto the grid.\n", numRegions,
+			shapeFileNames[regionFileNum].c_str());
+	#endif
+
+	vector< vector<int> > inside(numRegions);
+	#pragma omp parallel for schedule(dynamic, 1)
+	for (int entity = 0; entity < numRegions; entity++) {
+		int firstPoint = shapes.partStart[shapes.entityStart[entity]];
+		int lastPoint = shapes.partStart[shapes.entityStart[entity + 1]];
+		if (firstPoint == lastPoint) continue;
+
+		float exMin = MAX_FLOAT, exMax = -MAX_FLOAT, eyMin = MAX_FLOAT, eyMax = -MAX_FLOAT;
+		for (int i = firstPoint; i < lastPoint; i++) {
+			exMin = min(exMin, shapes.coords[2 * i]);
+			exMax = max(exMax, shapes.coords[2 * i]);
+			eyMin = min(eyMin, shapes.coords[2 * i + 1]);
+			eyMax = max(eyMax, shapes.coords[2 * i + 1]);
+		}
+		if (exMax < xMin || exMin > xMax || eyMax < yMin || eyMin > yMax) continue;
+
+		int firstCol, lastCol, firstRow, lastRow;
+		cellBinRange(exMin, exMax, xMin, binWidth, binCols, firstCol, lastCol);
+		cellBinRange(eyMin, eyMax, yMin, binHeight, binRows, firstRow, lastRow);
+		for (int row = firstRow; row <= lastRow; row++) {
+			for (int col = firstCol; col <= lastCol; col++) {
+				int b = row * binCols + col;
+				for (int k = binStart[b]; k < binStart[b + 1]; k++) {
+					int i = binPoints[k];
+					float x = weatherCoords[2 * i], y = weatherCoords[2 * i + 1];
+					if (x < exMin || x > exMax || y < eyMin || y > eyMax) continue;
+					if (pointInEntity(shapes, entity, x, y)) inside[entity].push_back(i);
+				}
+			}
+		}
+	}
+
+	// pack the memberships, first entity wins
+	vector<bool> taken(recSize, false);
+	vector<int>(1, 0).swap(regionStart);
+	regionCells.clear();
+	regionCellAreas.clear();
+	for (int entity = 0; entity < numRegions; entity++) {
+		for (int k = 0; k < inside[entity].size(); k++) {
+			int i = inside[entity][k];
+			if (taken[i]) continue;
+			taken[i] = true;
+			regionCells.push_back(i);
+			regionCellAreas.push_back(gridCellArea(i));
+		}
+		regionStart.push_back(regionCells.size());
+	}
+
+	readRegionNames();
+	regionIndexBuilt = true;
+
+	#ifdef CONSOLE_OUTPUT
+	printf("%d grid points fall inside the regions.\n", (int)regionCells.size());
+	#endif
+	return true;
+}
+
+// Totals attr over every region for every timestep, in one parallel pass
+// over the timesteps. The data is in kg/m^2(mm of water), so each point adds
+// value * area / 1000 cubic meters.
+bool computeRegionTotals(int attr) {
+	if (!buildRegionIndex()) return false;
+	if (attr == regionTotalsAttr) return true;
+
+	vector<double>((long)totalTimeSteps * numRegions, 0.0).swap(regionTotals);
+
+	#ifdef CONSOLE_OUTPUT
+	printf("Totaling %d regions over %d timesteps.\n", numRegions, totalTimeSteps);
+	#endif
+
+	#pragma omp parallel
+	{
+	fetchstate_t fetch;
+	openFetch(fetch);
+
+	// static blocks keep each worker's timesteps in as few Ncfiles as possible
+	#pragma omp for schedule(static)
+	for (int timeStep = 0; timeStep < totalTimeSteps; timeStep++) {
+		const float *values = fetchTimeStep(attr, timeStep, fetch);
+		// a record that couldn't be read keeps its totals at zero
+		if (values == NULL) continue;
+		double *totals = &regionTotals[(long)timeStep * numRegions];
+		for (int r = 0; r < numRegions; r++) {
+			double sum = 0.0;
+			for (int k = regionStart[r]; k < regionStart[r + 1]; k++) {
+				sum += values[regionCells[k]] * regionCellAreas[k];
+			}
+			totals[r] = sum / 1000.0;
+		}
+	}
+
+	closeFetch(fetch);
+	}
+
+	regionTotalsAttr = attr;
+
+	#ifdef CONSOLE_OUTPUT
+	printf("Region totals at timestep %d(m^3 of water):\n", currentTimeStep);
+	for (int r = 0; r < numRegions; r++) {
+		if (regionStart[r] == regionStart[r + 1]) continue;
+		printf("    %s: %.4g\n", regionNames[r].c_str(),
+				regionTotals[(long)currentTimeStep * numRegions + r]);
+	}
+	#endif
+	return true;
+}
+
+// one row per timestep, one column per region that covers part of the grid
+void writeRegionCSV(char *fileName) {
+	FILE *fout = fopen(fileName, "w");
+	if (fout == NULL) {
+		#ifndef ERROR_NOTIFICATION_OFF
+		fprintf(stderr, "Error: Couldn't write %s.\n", fileName);
+		#endif
+		return;
+	}
+
+	fprintf(fout, "Timestep");
+	for (int r = 0; r < numRegions; r++) {
+		if (regionStart[r] == regionStart[r + 1]) continue;
+		// quoted, names can have commas
+		fprintf(fout, ",\"%s\"", regionNames[r].c_str());
+	}
+	fprintf(fout, "\n");
+	for (int timeStep = 0; timeStep < totalTimeSteps; timeStep++) {
+		fprintf(fout, "%d", timeStep);
+		for (int r = 0; r < numRegions; r++) {
+			if (regionStart[r] == regionStart[r + 1]) continue;
+			fprintf(fout, ",%.6g", regionTotals[(long)timeStep * numRegions + r]);
+		}
+		fprintf(fout, "\n");
+	}
+	fclose(fout);
+
+	#ifdef CONSOLE_OUTPUT
+	printf("Wrote region totals to %s.\n", fileName);
+	#endif
+	return;
+}
+
+// Draws a square around each station, red where the model is high and blue
+// where it's low, sized by the station's rmse
+void drawValidation(void) {
+	float maxRmse = 0.0;
+	for (int stationNum = 0; stationNum < stationValidation.size(); stationNum++) {
+		maxRmse = max(maxRmse, stationValidation[stationNum].rmse);
+	}
+	if (maxRmse <= 0.0) maxRmse = 1.0;
+
+	glLineWidth(2.0);
+	for (int stationNum = 0; stationNum < stationValidation.size(); stationNum++) {
+		const validation_t &v = stationValidation[stationNum];
+		if (v.numDays == 0) continue;
+
+		coord_t station = csvCoords[stationNum];
+		float size = 0.03 + 0.07 * (v.rmse / maxRmse);
+		if (v.bias >= 0.0) glColor3ub(255, 0, 0);
+		else glColor3ub(0, 0, 255);
+
+		glBegin(GL_LINE_LOOP);
+			glVertex3f(station.x - size, station.y - size, station.z);
+			glVertex3f(station.x + size, station.y - size, station.z);
+			glVertex3f(station.x + size, station.y + size, station.z);
+			glVertex3f(station.x - size, station.y + size, station.z);
+		glEnd();
+	}
+	glLineWidth(1.0);
+	return;
+}
+
+void drawTriangle(coord_t center, float size) {
+    glBegin(GL_LINE_LOOP);
+		glVertex3f(center.x, center.y + size, center.z);
+		glVertex3f(center.x - size, center.y - size, center.z);
+		glVertex3f(center.x + size, center.y - size, center.z);
+    glEnd();
+    return;
+}
+
+void drawX(coord_t center, float size) {
+	glBegin(GL_LINES);
+		glVertex3f(center.x - size, center.y + size, center.z);
+		glVertex3f(center.x + size, center.y - size, center.z);
+		glVertex3f(center.x + size, center.y + size, center.z);
+		glVertex3f(center.x - size, center.y - size, center.z);
+	glEnd();
+	return;
+}
+
+void drawStations(int day) {
+	#ifdef DEBUG2
+	printf("currentTimeStep = %d day = %d\n", currentTimeStep, day);
+	#endif
+
+	// stay in the limits
+	if (day > 365) {
+		//cerr << "Error: Day was out of bounds" << endl;
+		// may need to change this depending on desired behavior
+		currentTimeStep = 0;
+		return;
+	}
+	// the station data may not cover the whole simulation
+	if (day >= numCsvDays) return;
+
+	// size of the station data triangles
+	float stationSize = 0.025;
+
+	for (int stationNum = 0; stationNum < csvCoords.size(); stationNum++) {
+		// normalize the data
+		float val = csvData[(long)day * numCsvStations + stationNum];
+		if (val == CSV_MISSING) continue;
+		const GLubyte *color = &transLUT[4 * transferLUTIndex(val)];
+		GLubyte newRed = color[0], newGreen = color[1], newBlue = color[2];
+		
+		coord_t station = csvCoords[stationNum];
+		// draw the stations as triangles
+		glColor4ub(newRed, newGreen, newBlue, transparency);
+		glBegin(GL_TRIANGLES);
+			glVertex3f(station.x, station.y + stationSize, station.z);
+			glVertex3f(station.x - stationSize, station.y - stationSize, station.z);
+			glVertex3f(station.x + stationSize, station.y - stationSize, station.z);
+		glEnd();
+
+		// outline the stations for visability
+		glColor3ub(0, 0, 0);
+		drawTriangle(station, stationSize);
+	}
+	return;
+}
+
+void drawText(int totalDays) {
+	string year = "";
+	char *month;
+	char day[3];
+
+	// index this at 1, not 0
+	totalDays++;
+
+	if (totalDays < 62) year += ", 2001";
+	else year += ", 2002";
+
+	// find the date based on 11-1
+	if (totalDays < 31) {
+		month = "November ";
+	}
+	else if (totalDays < 62) {
+		month = "Decemeber ";
+		totalDays -= 30;
+	}
+	else if (totalDays < 93) {
+		month = "January ";
+		totalDays -= 61;
+	}
+	else if (totalDays < 121) {
+		month = "February ";
+		totalDays -= 92;
+	}
+	else if (totalDays < 152) {
+		month = "March ";
+		totalDays -= 120;
+	}
+	else if (totalDays < 182) {
+		month = "April ";
+		totalDays -= 151;
+	}
+	else if (totalDays < 213) {
+		month = "May ";
+		totalDays -= 181;
+	}
+	else if (totalDays < 243) {
+		month = "June ";
+		totalDays -= 212;
+	}
+	else if (totalDays < 274) {
+		month = "July ";
+		totalDays -= 242;
 	}
 	else if (totalDays < 305) {
 		month = "August ";
@@ -1244,6 +2621,9 @@ void drawText(int totalDays) {
 		case RUNOFF_DAILY:
 			attr = "Daily Runoff";
 			break;
+		case OBSERVED_SNOWPACK:
+			attr = "Observed Snowpack";
+			break;
 		default:
 			unreachable("drawText()");
 			attr = "ERROR!";
@@ -1294,7 +2674,7 @@ void drawTransferLegend(void) {
 	lRight = screen2worldCoords(lRightX - SPACING, lRightY - SPACING, eye[2] - TEXT_DIST);
 
 	// normal weather attributes
-	if (0 <= weatherAttrNum && weatherAttrNum <= 3) {
+	if (!isDailyAttribute(weatherAttrNum)) {
 		// compute the colors based on the transfer file
 		long fullSize = transFuncData.size();
 		for (int i = 0; i < fullSize; i++) {
@@ -1447,42 +2827,179 @@ void drawColorbar(vector<trans_t> colors, vector<coord_t> coords, attribute_t ty
 }
 
 void drawShapedata(int fileNum) {
-	int startIndex, numPoints;
-
 	// white is easy to see
 	glColor3ub(255, 255, 255);
 
 	#ifdef SHP_TIMING_ON
 	double elapsedTime;
 	clock_t startTime, endTime;
+	// make sure we only time this map
+	glFinish();
 	// start timing
 	startTime = clock();
 	#endif
 
-	// draw all entities
-	for (int currEntity = 0; currEntity < shapeCoords[fileNum].size(); currEntity++) {
-		for (int currPart = 0; currPart < partOffsets[fileNum][currEntity].size() - 1; currPart++) {
-			// get the start and end index for this part
-			startIndex = partOffsets[fileNum][currEntity][currPart];
-			numPoints = partOffsets[fileNum][currEntity][currPart + 1] - startIndex;
-
-			glEnableClientState(GL_VERTEX_ARRAY);
+	#ifdef SHP_UNBATCHED
+	// draw all parts of all entities
+	const shapedata_t &shapes = shapeFiles[fileNum];
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glVertexPointer(2, GL_FLOAT, 0, shapes.coords);
+	for (int currPart = 0; currPart < shapes.numParts; currPart++) {
+		// get the start and end index for this part
+		int startIndex = shapes.partStart[currPart];
+		int numPoints = shapes.partStart[currPart + 1] - startIndex;
+		glDrawArrays(GL_LINE_LOOP, startIndex, numPoints);
+	}
+	glDisableClientState(GL_VERTEX_ARRAY);
+	#else
+	// draw every part of every entity with one call
+	shapebatch_t &batch = shapeBatches[fileNum];
+	int level = shapeLevelOfDetail();
+	if (batch.buffer != 0 && batch.count[level].size() > 0) {
+		glEnableClientState(GL_VERTEX_ARRAY);
+		glBindBuffer(GL_ARRAY_BUFFER, batch.buffer);
+		glVertexPointer(2, GL_FLOAT, 0, 0);
 
-			// draw the shape data efficiently
-			glVertexPointer(2, GL_FLOAT, 0, &shapeCoords[fileNum][currEntity][0]);
-			glDrawArrays(GL_LINE_LOOP, startIndex, numPoints);
+		glMultiDrawArrays(GL_LINE_LOOP, &batch.first[level][0], &batch.count[level][0],
+				batch.count[level].size());
 
-			glDisableClientState(GL_VERTEX_ARRAY);
-		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+		glDisableClientState(GL_VERTEX_ARRAY);
 	}
+	#endif
 
 	#ifdef SHP_TIMING_ON
+	glFinish();
 	// stop timing
 	endTime = clock();
 	// calculate the elapsed time
 	elapsedTime = (double)(endTime - startTime);
-	printf("Map number %d drawn in %f seconds.\n", fileNum, (double)elapsedTime / (double)CLOCKS_PER_SEC);
+	#ifdef SHP_UNBATCHED
+	// every point is drawn
+	int level = 0;
 	#endif
+	printf("Map number %d drawn at detail level %d in %f seconds.\n", fileNum, level,
+			(double)elapsedTime / (double)CLOCKS_PER_SEC);
+	#endif
+	return;
+}
+
+// the coarsest level of detail that is still within half a pixel
+int shapeLevelOfDetail(void) {
+	// world units covered by one pixel at the current zoom
+	double pixelSize = 2.0 * eye[2] * tan(FOVY * M_PI / 360.0) / screenHeight;
+	int level = 0;
+	while (level + 1 < SHAPE_LOD_LEVELS && SHAPE_LOD_TOLERANCE[level + 1] <= 0.5 * pixelSize) {
+		level++;
+	}
+	return level;
+}
+
+// Douglas-Peucker simplification of one part. The first and last points are
+// always kept; the result is appended to result as interleaved x,y.
+void simplifyPolyline(const float *coords, int numPoints, float tolerance, vector<float> &result) {
+	if (numPoints <= 2 || tolerance <= 0.0) {
+		result.insert(result.end(), coords, coords + 2 * numPoints);
+		return;
+	}
+
+	vector<bool> keep(numPoints, false);
+	keep[0] = keep[numPoints - 1] = true;
+
+	// an explicit stack of ranges, coastlines are too long to recurse on
+	vector< pair<int, int> > ranges;
+	ranges.push_back(make_pair(0, numPoints - 1));
+	while (!ranges.empty()) {
+		int first = ranges.back().first, last = ranges.back().second;
+		ranges.pop_back();
+		if (last - first < 2) continue;
+
+		float ax = coords[2 * first], ay = coords[2 * first + 1];
+		float dx = coords[2 * last] - ax, dy = coords[2 * last + 1] - ay;
+		float lengthSq = dx * dx + dy * dy;
+
+		// find the point farthest from the segment first-last
+		int farthest = -1;
+		float maxDistSq = tolerance * tolerance;
+		for (int i = first + 1; i < last; i++) {
+			float px = coords[2 * i] - ax, py = coords[2 * i + 1] - ay;
+			float distSq;
+			// rings start and end on the same point
+			if (lengthSq == 0.0) distSq = px * px + py * py;
+			else {
+				float t = (px * dx + py * dy) / lengthSq;
+				t = (t < 0.0) ? 0.0 : ((t > 1.0) ? 1.0 : t);
+				float ex = px - t * dx, ey = py - t * dy;
+				distSq = ex * ex + ey * ey;
+			}
+			if (distSq > maxDistSq) {
+				maxDistSq = distSq;
+				farthest = i;
+			}
+		}
+
+		if (farthest != -1) {
+			keep[farthest] = true;
+			ranges.push_back(make_pair(first, farthest));
+			ranges.push_back(make_pair(farthest, last));
+		}
+	}
+
+	for (int i = 0; i < numPoints; i++) {
+		if (!keep[i]) continue;
+		result.push_back(coords[2 * i]);
+		result.push_back(coords[2 * i + 1]);
+	}
+	return;
+}
+
+// builds every level of detail of one shapefile into shapeBatches[fileNum]
+void buildShapeBatch(int fileNum) {
+	shapebatch_t &batch = shapeBatches[fileNum];
+	const shapedata_t &shapes = shapeFiles[fileNum];
+	batch.first.resize(SHAPE_LOD_LEVELS);
+	batch.count.resize(SHAPE_LOD_LEVELS);
+
+	for (int level = 0; level < SHAPE_LOD_LEVELS; level++) {
+		for (int currPart = 0; currPart < shapes.numParts; currPart++) {
+			int startIndex = shapes.partStart[currPart];
+			int numPoints = shapes.partStart[currPart + 1] - startIndex;
+
+			GLint first = batch.vertices.size() / 2;
+			simplifyPolyline(&shapes.coords[2 * startIndex], numPoints,
+					SHAPE_LOD_TOLERANCE[level], batch.vertices);
+			GLsizei count = batch.vertices.size() / 2 - first;
+
+			// nothing left worth drawing
+			if (count < 2) {
+				batch.vertices.resize(2 * first);
+				continue;
+			}
+			batch.first[level].push_back(first);
+			batch.count[level].push_back(count);
+		}
+		#ifdef CONSOLE_OUTPUT
+		int numPoints = 0;
+		for (int i = 0; i < batch.count[level].size(); i++) numPoints += batch.count[level][i];
+		printf("    detail level %d: %d points\n", level, numPoints);
+		#endif
+	}
+	return;
+}
+
+// uploads the shape batches, needs a current GL context
+void initShapeBuffers(void) {
+	for (int fileNum = 0; fileNum < shapeBatches.size(); fileNum++) {
+		shapebatch_t &batch = shapeBatches[fileNum];
+		if (batch.vertices.empty()) continue;
+
+		glGenBuffers(1, &batch.buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, batch.buffer);
+		glBufferData(GL_ARRAY_BUFFER, batch.vertices.size() * sizeof(float),
+				&batch.vertices[0], GL_STATIC_DRAW);
+		vector<float>().swap(batch.vertices);
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 	return;
 }
 
@@ -1529,11 +3046,55 @@ double calcDistance(float x1, float y1, float x2, float y2) {
 	return sqrt(pow(x2 - x1, 2) + pow(y2 - y1, 2));
 }
 
-// Note: matrices must be in column major order
-void solve4x4Lapack(double *a, double *b) {
-	int n = 4, lda = 4, ldb = 4, nrhs = 1, info, ipiv[4];
+// Inverts the bilinear map of the cell whose lower left corner is at
+// weatherCoords[index] and returns the weights of its 4 corners at (x,y) in
+// w, ordered bottom left, bottom right, top right, top left. Solving for the
+// cell parameters (u,v) is a single quadratic, so no linear solver is needed.
+void bilinearWeights(float x, float y, int index, float *w) {
+	int pointsPerRow = numCols * 2;
+	double xa = weatherCoords[index], ya = weatherCoords[index + 1];
+	double xb = weatherCoords[index + 2], yb = weatherCoords[index + 3];
+	double xc = weatherCoords[index + pointsPerRow + 2];
+	double yc = weatherCoords[index + pointsPerRow + 3];
+	double xd = weatherCoords[index + pointsPerRow];
+	double yd = weatherCoords[index + pointsPerRow + 1];
+
+	// p = a + e*u + f*v + g*u*v
+	double ex = xb - xa, ey = yb - ya;
+	double fx = xd - xa, fy = yd - ya;
+	double gx = xa - xb + xc - xd, gy = ya - yb + yc - yd;
+	double hx = x - xa, hy = y - ya;
+
+	// eliminating u leaves k2*v^2 + k1*v + k0 = 0
+	double k2 = gx*fy - gy*fx;
+	double k1 = ex*fy - ey*fx + hx*gy - hy*gx;
+	double k0 = hx*ey - hy*ex;
+	double u, v;
+
+	if (fabs(k2) <= 1e-12 * fabs(k1)) {
+		// the cell is a parallelogram
+		v = (k1 != 0.0) ? -k0 / k1 : 0.0;
+	} else {
+		double disc = k1*k1 - 4.0*k0*k2;
+		disc = (disc > 0.0) ? sqrt(disc) : 0.0;
+		v = (-k1 - disc) / (2.0*k2);
+		if (v < -0.001 || v > 1.001) v = (-k1 + disc) / (2.0*k2);
+	}
+
+	// solve for u with whichever axis is better conditioned
+	double denx = ex + gx*v, deny = ey + gy*v;
+	if (fabs(denx) > fabs(deny)) u = (hx - fx*v) / denx;
+	else if (deny != 0.0) u = (hy - fy*v) / deny;
+	else u = 0.0;
+
+	// points on an edge can land a hair outside the cell
+	if (u < 0.0) u = 0.0; else if (u > 1.0) u = 1.0;
+	if (v < 0.0) v = 0.0; else if (v > 1.0) v = 1.0;
 
-	dgesv_(&n, &nrhs, a, &lda, ipiv, b, &ldb, &info);
+	w[0] = (1.0 - u) * (1.0 - v);
+	w[1] = u * (1.0 - v);
+	w[2] = u * v;
+	w[3] = (1.0 - u) * v;
 
 	return;
 }
@@ -1548,123 +3109,122 @@ void calcSliceSteps(void) {
 	return;
 }
 
-void interpolateSliceGraph(float *sliceData, int sdsize) {
-	float t, x, y;
-	double vala, valb, valc, vald;
-	double xa, ya, xb, yb, xc, yc, xd, yd;
-	// TODO: take these lines out, not consistent:(i < 2*recSize - pointsPerRow)
-	int pointsPerRow = numCols * 2;
-	int pointsPerCol = numRows;
-	bool insideGraph = false;
-
-	// switch the points if they're out of order by x coord
-	// we want a left-to-right graph
-	if (lineStart.x > lineEnd.x) {
-		coord_t c = lineStart;
-		lineStart = lineEnd;
-		lineEnd = c;
-	}
-
-	/* allocate space for the slice data
-	if (snowpackSliceData == NULL)
-		snowpackSliceData = new float[totalTimeSteps * totalSliceSteps];
-	if (snowfallSliceData == NULL)
-		snowfallSliceData = new float[totalTimeSteps * totalSliceSteps];
-	if (precipitationSliceData == NULL)
-		precipitationSliceData = new float[totalTimeSteps * totalSliceSteps];
-	if (runoffSliceData == NULL)
-		runoffSliceData = new float[totalTimeSteps * totalSliceSteps];
-	// */
-
-	// ****calculate the actual data for the slice graph
-
-	int index = 0;
-	// bilinearly interpolate the data for all attributes
-	for (int sliceStep = 0; sliceStep < totalSliceSteps; sliceStep++) {
-		t = (float)sliceStep / totalSliceSteps;
-		x = (1-t)*lineStart.x + t*lineEnd.x;
-		y = (1-t)*lineStart.y + t*lineEnd.y;
-
-		// if we haven't found a point inside the grid
-		if (!insideGraph) {
-			// see if this point is inside the grid
-			if (findFirstCell(x, y, index)) {
-				insideGraph = true;
-			}
-		}
-
-		// get the next interpolation index
-		if (!nextInterpolationPoint(x, y, index, 1)) {
-			insideGraph = false;
-		}
-
-		// make sure the index is in range
-		if ((index > 2*recSize - pointsPerRow) || (index % pointsPerRow == (pointsPerRow - 1))) {
-			fprintf(stderr, "Index %d out of range at sliceStep = %d\n", index, sliceStep);
-			unreachable("interpolateSliceGraph");
-			return;
-		}
+// Interpolates values, the record of an attribute at one timestep, at every
+// sample along the slice line. It's only a gather through the table built by
+// updateSliceTable(), so it's safe to call from several threads at once.
+void interpolateSliceGraph(float *sliceData, int sdsize, const float *values) {
+	for (int sliceStep = 0; sliceStep < sdsize; sliceStep++) {
+		int index = sliceCells[sliceStep];
 
 		// if this step on the line is out of the grid
-		if (!insideGraph) {
+		if (index < 0 || values == NULL) {
 			// store null values in the arrays
 			sliceData[sliceStep] = 0.0;
 			continue;
 		}
+		sliceData[sliceStep] = interpolateCell(values, index, &sliceWeights[4 * sliceStep]);
+	}
+	return;
+}
 
-		// get the coords of the cell
-		xa = (double)weatherCoords[index];
-		ya = (double)weatherCoords[index + 1];
-		xb = (double)weatherCoords[index + 2];
-		yb = (double)weatherCoords[index + 3];
-		xc = (double)weatherCoords[index + pointsPerRow + 2];
-		yc = (double)weatherCoords[index + pointsPerRow + 3];
-		xd = (double)weatherCoords[index + pointsPerRow];
-		yd = (double)weatherCoords[index + pointsPerRow + 1];
-
-		// get the data for the 4 corners of the cell for all attributes
-		vala = (double)weatherData[currentTimeStep*recSize + (index/2)];
-		valb = (double)weatherData[currentTimeStep*recSize + (index/2 + 1)];
-		valc = (double)weatherData[currentTimeStep*recSize + (index/2 + numCols + 1)];
-		vald = (double)weatherData[currentTimeStep*recSize + (index/2 + numCols)];
+// Finds the cell and weights of every sample along the slice line, and the
+// x axis legend, if the line changed since the last call
+void updateSliceTable(void) {
+	orderSliceLine();
+	if (sliceTableSteps == totalSliceSteps &&
+			sliceTableStart.x == lineStart.x && sliceTableStart.y == lineStart.y &&
+			sliceTableEnd.x == lineEnd.x && sliceTableEnd.y == lineEnd.y) {
+		return;
+	}
 
-		// set up the coeffecient matrix in column major order
-		double A[16] = {
-			1.0, 1.0, 1.0, 1.0,
-			xa, xb, xc, xd,
-			ya, yb, yc, yd,
-			xa*ya, xb*yb, xc*yc, xd*yd
-		};
+	sliceCells.resize(totalSliceSteps);
+	sliceWeights.resize(4 * totalSliceSteps);
+	if (totalSliceSteps > 0) traceSliceCells(&sliceCells[0], totalSliceSteps);
 
-		// set up the answer column for all attributes
-		double B[4] = {vala, valb, valc, vald};
+	for (int sliceStep = 0; sliceStep < totalSliceSteps; sliceStep++) {
+		if (sliceCells[sliceStep] < 0) continue;
+		float t = (float)sliceStep / totalSliceSteps;
+		float x = (1-t)*lineStart.x + t*lineEnd.x;
+		float y = (1-t)*lineStart.y + t*lineEnd.y;
+		bilinearWeights(x, y, sliceCells[sliceStep], &sliceWeights[4 * sliceStep]);
+	}
 
-		// solve the 4 simultaneous equations
-		solve4x4Lapack(A, B);
+	sliceTableStart = lineStart;
+	sliceTableEnd = lineEnd;
+	sliceTableSteps = totalSliceSteps;
+	// everything in the slice cache is for the old line
+	sliceTableVersion++;
 
-		// compute the final value for the current interpolation point
-		float sliceValue = B[0] + B[1]*x + B[2]*y + B[3]*x*y;
+	computeSliceLegend();
+	return;
+}
 
-		#ifdef DEBUG2
-		if (sliceValue < 0.0) {
-			fprintf(stderr, "ERROR[%d]: Snowpack cannot be negative. val = %f at (%f,%f)\n",
-					numErrors++, sliceValue, x, y);
+// Returns the slice of attr at timeStep along the current line, only
+// interpolating it if it isn't cached. Only call this from the GLUT thread.
+const float *getSliceData(int attr, int timeStep) {
+	updateSliceTable();
+	if (totalSliceSteps <= 0) return NULL;
+
+	for (int k = 0; k < SLICE_CACHE_SIZE; k++) {
+		if (sliceCache[k].tableVersion == sliceTableVersion &&
+				sliceCache[k].attr == attr && sliceCache[k].timeStep == timeStep &&
+				!sliceCache[k].data.empty()) {
+			return &sliceCache[k].data[0];
 		}
-		if (precSliceValue < 0.0) {
-			fprintf(stderr, "ERROR[%d]: Precipitation cannot be negative. val = %f at (%f,%f)\n",
-					numErrors++, precSliceValue, x, y);
-		}
-		#endif
-
-		// store the value in the slice data array
-		sliceData[sliceStep] = sliceValue;
 	}
+
+	// replace the oldest slice
+	slicecache_t &entry = sliceCache[sliceCacheNext];
+	sliceCacheNext = (sliceCacheNext + 1) % SLICE_CACHE_SIZE;
+
+	entry.data.resize(totalSliceSteps);
+	interpolateSliceGraph(&entry.data[0], totalSliceSteps, getTimeStep(attr, timeStep));
+	entry.attr = attr;
+	entry.timeStep = timeStep;
+	entry.tableVersion = sliceTableVersion;
 	#ifdef CONSOLE_OUTPUT2
-	cout << "Done interpolating. timeStep = " << currentTimeStep << endl;
+	cout << "Done interpolating. timeStep = " << timeStep << endl;
 	#endif
+	return &entry.data[0];
+}
+
+// Posts a redisplay of the slice window, but only if something it shows
+// changed since the last one
+void updateSliceWindow(void) {
+	if (sliceWindow == -1) return;
+
+	slicekey_t key = {lineStart, lineEnd, totalSliceSteps, weatherAttrNum, currentTimeStep,
+			transparency, transferVersion, hovmollerMode, drawingLine};
+	if (key.start.x == sliceWindowKey.start.x && key.start.y == sliceWindowKey.start.y &&
+			key.end.x == sliceWindowKey.end.x && key.end.y == sliceWindowKey.end.y &&
+			key.steps == sliceWindowKey.steps && key.attrNum == sliceWindowKey.attrNum &&
+			key.timeStep == sliceWindowKey.timeStep &&
+			key.transparency == sliceWindowKey.transparency &&
+			key.transferVersion == sliceWindowKey.transferVersion &&
+			key.hovmoller == sliceWindowKey.hovmoller &&
+			key.drawingLine == sliceWindowKey.drawingLine) {
+		return;
+	}
+
+	sliceWindowKey = key;
+	glutPostWindowRedisplay(sliceWindow);
+	return;
+}
 
-	// ****calculate the coords for the x axis
+// switch the points if they're out of order by x coord
+// we want a left-to-right graph
+void orderSliceLine(void) {
+	if (lineStart.x > lineEnd.x) {
+		coord_t c = lineStart;
+		lineStart = lineEnd;
+		lineEnd = c;
+	}
+	return;
+}
 
+// computes the coords for the x axis of the slice graph
+void computeSliceLegend(void) {
+	sliceLegendCoords.clear();
 	sliceLegendCoords.push_back(lineStart);
 	sliceLegendCoords.push_back(lineEnd);
 
@@ -1692,301 +3252,2184 @@ void interpolateSliceGraph(float *sliceData, int sdsize) {
 	return;
 }
 
-// checks to see if (x,y) is inside the cell with bottom-left point index i
-// TODO: make sure i by ref is OK
-bool insideCell(float x, float y, int &i) {
-	int pointsPerRow = numCols * 2;
-	coord_t bottomLeft, bottomRight, topRight, topLeft;
+// weights the 4 corners of the cell with lower left corner index by w, in the
+// order returned by bilinearWeights()
+inline float interpolateCell(const float *values, int index, const float *w) {
+	return w[0] * values[index/2]
+			+ w[1] * values[index/2 + 1]
+			+ w[2] * values[index/2 + numCols + 1]
+			+ w[3] * values[index/2 + numCols];
+}
 
-	// get the coords of the 4 corners of this cell
-	bottomLeft.x = weatherCoords[i];
-	bottomLeft.y = weatherCoords[i + 1];
-	bottomRight.x = weatherCoords[i + 2];
-	bottomRight.y = weatherCoords[i + 3];
-	topLeft.x = weatherCoords[i + pointsPerRow];
-	topLeft.y = weatherCoords[i + pointsPerRow + 1];
-	topRight.x = weatherCoords[i + pointsPerRow + 2];
-	topRight.y = weatherCoords[i + pointsPerRow + 3];
-
-	coord_t c = {x, y, 0.0};
-	// return false if it is on the outside any edge
-	if (aboveOrBelowLine(bottomLeft, bottomRight, c) == BELOW_LINE) return false;
-	if (aboveOrBelowLine(bottomRight, topRight, c) == ABOVE_LINE) return false;
-	if (aboveOrBelowLine(topLeft, topRight, c) == ABOVE_LINE) return false;
-	if (aboveOrBelowLine(topLeft, bottomLeft, c) == BELOW_LINE) return false;
+// Computes the slice at every timestep for the Hovmoller view. The cell and
+// weights of every sample are found once, then the timesteps are gathered
+// in parallel. In streaming mode the workers read the records themselves.
+void computeHovmoller(void) {
+	updateSliceTable();
 
-	return true;
-}
+	int attr = dataAttribute(weatherAttrNum);
+	int sdsize = totalSliceSteps;
 
-// index is set the the index of the x coord of the lower left corner
-bool findFirstCell(float x, float y, int &index) {
-	#ifdef DEBUG2
-	printf("findFirstCell(%f,%f)\n", x, y);
+	delete [] hovmollerData;
+	hovmollerData = new float[(long)totalTimeSteps * sdsize];
+
+	#ifdef CONSOLE_OUTPUT
+	printf("Computing the Hovmoller view for %d timesteps.\n", totalTimeSteps);
 	#endif
 
-	coord_t c = {x, y, 0.0};
-	coord_t bottomLeft, bottomRight, topRight, topLeft;
-	int pointsPerRow = numCols * 2;
-	int pointsPerCol = numRows;
-	int i;
-	// check each cell of weatherData to see if (x,y) is in it
-	for (int row = 0; row < numRows - 1; row++) {
-		for (int col = 0; col < 2*(numCols - 1); col += 2) {
-			i = row * pointsPerRow + col;
-
-			bottomLeft.x = weatherCoords[i];
-			bottomLeft.y = weatherCoords[i + 1];
-			// first check if the point is far from the bottom corner
-			if (calcDistance(x, y, bottomLeft.x, bottomLeft.y) > 1.0) continue;
-
-			bottomRight.x = weatherCoords[i + 2];
-			bottomRight.y = weatherCoords[i + 3];
-			// check if the point is below the bottom edge
-			if (aboveOrBelowLine(bottomLeft, bottomRight, c) == BELOW_LINE) continue;
-
-			topLeft.x = weatherCoords[i + pointsPerRow];
-			topLeft.y = weatherCoords[i + pointsPerRow + 1];
-			// check if the point is below(outside) the left edge
-			if (aboveOrBelowLine(topLeft, bottomLeft, c) == BELOW_LINE) continue;
-
-			topRight.x = weatherCoords[i + pointsPerRow + 2];
-			topRight.y = weatherCoords[i + pointsPerRow + 3];
-			// check if the point is above(outside) the right edge
-			if (aboveOrBelowLine(bottomRight, topRight, c) == ABOVE_LINE) continue;
-
-			// check if the point is above the top edge
-			if (aboveOrBelowLine(topRight, topLeft, c) == ABOVE_LINE) continue;
-
-			// the point is in the cell
-			index = i;
-			return true;
-		}
+	#pragma omp parallel
+	{
+	fetchstate_t fetch;
+	openFetch(fetch);
+
+	// static blocks keep each worker's timesteps in as few Ncfiles as possible
+	#pragma omp for schedule(static)
+	for (int timeStep = 0; timeStep < totalTimeSteps; timeStep++) {
+		const float *values = fetchTimeStep(attr, timeStep, fetch);
+		interpolateSliceGraph(hovmollerData + (long)timeStep * sdsize, sdsize, values);
 	}
-	return false;
-}
 
-// Recursively checks if the point (x,y) is inside the cell with bottom left
-// corner == index. If the point is outside an edge of a cell, the insideCell()
-// function will set index to the bottom left corner of the next adjacent cell in
-// the direction of the point.
-bool nextInterpolationPoint(float x, float y, int &index, int level) {
-	int pointsPerRow = 2 * numCols;
-	// if recursed a bunch already
-	if (level > 10) {
-		// just check the whole grid
-		if (findFirstCell(x, y, index)) return true;
-		else return false;
+	closeFetch(fetch);
 	}
 
-	// make sure the index to check is in range
-	if ((index > 2*recSize - pointsPerRow) || (index % pointsPerRow == (pointsPerRow - 1))) {
+	hovmollerDataAttr = attr;
+	hovmollerSteps = sdsize;
+	hovmollerStart = lineStart;
+	hovmollerEnd = lineEnd;
+	// force the colors to be redone
+	hovmollerColorsKey.attrNum = -1;
+	return;
+}
+
+// Textures are limited in height, so very long runs only color every n-th
+// timestep of the image.
+int hovmollerRowStride(void) {
+	GLint maxSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	if (maxSize <= 0) maxSize = 2048;
+	return (totalTimeSteps + maxSize - 1) / maxSize;
+}
+
+// Recolors the Hovmoller image if the attribute, transparency or transfer
+// function changed. Returns true if it did.
+bool updateHovmollerColors(void) {
+	colorkey_t key = {weatherAttrNum, 0, transparency, transferVersion};
+	if (key.attrNum == hovmollerColorsKey.attrNum &&
+			key.transparency == hovmollerColorsKey.transparency &&
+			key.transferVersion == hovmollerColorsKey.transferVersion) {
 		return false;
 	}
 
-	// return true if it's inside this cell
-	if (insideCell(x, y, index)) return true;
-	// keep checking if it's not
-	else return nextInterpolationPoint(x, y, index, level + 1);
+	int sdsize = hovmollerSteps;
+	int stride = hovmollerRowStride();
+	int imageRows = (totalTimeSteps + stride - 1) / stride;
+	delete [] hovmollerColors;
+	hovmollerColors = new GLubyte[4L * imageRows * sdsize];
+
+	// the workers can't all rebuild the table at once
+	if (transLUTAlpha != transparency) setTransferLUTAlpha(transparency);
+
+	#pragma omp parallel for
+	for (int row = 0; row < imageRows; row++) {
+		int timeStep = row * stride;
+		float *values = hovmollerData + (long)timeStep * sdsize;
+		GLubyte *colors = hovmollerColors + 4L * row * sdsize;
+
+		if (!isDailyAttribute(weatherAttrNum)) {
+			computeColors(colors, 4 * sdsize, values);
+		}
+		else {
+			computeDailyColors(colors, 4 * sdsize, values,
+					(timeStep == 0) ? NULL : values - sdsize);
+		}
+	}
 
-	unreachable("nextInterpolationPoint");
+	hovmollerColorsKey = key;
 	return true;
 }
 
-void getNcFileData(char **fileList) {
-	for (int fileNum = 0; fileNum < numNcFiles; fileNum++) {
-		char *fileName = fileList[fileNum];
+// Draws the slice at every timestep as an image, distance along the line to
+// the right and time going up, with a cursor at the current timestep.
+void drawHovmoller(void) {
+	if (totalSliceSteps <= 0) return;
+
+	// wait until the line is finished to recompute
+	if (!drawingLine && (hovmollerData == NULL ||
+			hovmollerDataAttr != dataAttribute(weatherAttrNum) ||
+			hovmollerSteps != totalSliceSteps ||
+			hovmollerStart.x != lineStart.x || hovmollerStart.y != lineStart.y ||
+			hovmollerEnd.x != lineEnd.x || hovmollerEnd.y != lineEnd.y)) {
+		computeHovmoller();
+	}
+	if (hovmollerData == NULL) return;
+
+	if (hovmollerTexture == 0) {
+		glGenTextures(1, &hovmollerTexture);
+		glBindTexture(GL_TEXTURE_2D, hovmollerTexture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	glBindTexture(GL_TEXTURE_2D, hovmollerTexture);
+
+	if (updateHovmollerColors()) {
+		int stride = hovmollerRowStride();
+		int imageRows = (totalTimeSteps + stride - 1) / stride;
+		glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, hovmollerSteps, imageRows, 0,
+				GL_RGBA, GL_UNSIGNED_BYTE, hovmollerColors);
+	}
 
-		NcFile ncF(fileName);
-		// make sure the file is valid
-		if (!ncF.is_valid()) {
-			#ifndef ERROR_NOTIFICATION_OFF
-			printf("Error: %s is not a valid Ncfile.", fileName);
-			#endif
-			return;
-		}
+	glEnable(GL_TEXTURE_2D);
+	glColor3ub(255, 255, 255);
+	glBegin(GL_QUADS);
+		glTexCoord2i(0, 0); glVertex3f(0.0, 0.0, 0.0);
+		glTexCoord2i(1, 0); glVertex3f(SLICE_GRAPH_WIDTH, 0.0, 0.0);
+		glTexCoord2i(1, 1); glVertex3f(SLICE_GRAPH_WIDTH, SLICE_GRAPH_HEIGHT, 0.0);
+		glTexCoord2i(0, 1); glVertex3f(0.0, SLICE_GRAPH_HEIGHT, 0.0);
+	glEnd();
+	glDisable(GL_TEXTURE_2D);
 
-		#ifdef CONSOLE_OUTPUT
-		int startPos = 0;
-		// strip the prefix off the filename; it's ugly
-		for (int i = 0; i < strlen(fileName); i++) {
-			if (fileName[i] == '/') startPos = i + 1;
-		}
-		// check for index error
-		if (startPos > strlen(fileName) - 1) startPos = 0;
-		printf("Processing Ncfile[%d]: %s\n", fileNum, fileName + startPos);
-		#endif
+	// only the cursor moves during animation
+	float cursor = SLICE_GRAPH_HEIGHT * (currentTimeStep + 0.5) / totalTimeSteps;
+	glColor3f(0.54, 0.16, 0.88);
+	glLineWidth(3.0);
+	glBegin(GL_LINES);
+		glVertex3f(0.0, cursor, 0.0);
+		glVertex3f(SLICE_GRAPH_WIDTH, cursor, 0.0);
+	glEnd();
+	glLineWidth(1.0);
+	return;
+}
+
+// index is set the the index of the x coord of the lower left corner
+bool findFirstCell(float x, float y, int &index) {
+	#ifdef DEBUG2
+	printf("findFirstCell(%f,%f)\n", x, y);
+	#endif
 
-		// select which variables to access
-		NcVar *snowVar = ncF.get_var("SNOW");
-		NcVar *snowncVar = ncF.get_var("SNOWNC");
-		NcVar *raincVar = ncF.get_var("RAINC");
-		NcVar *rainncVar = ncF.get_var("RAINNC");
-		NcVar *sfroffVar = ncF.get_var("SFROFF");
-		NcVar *udroffVar = ncF.get_var("UDROFF");
-
-		// get references to values
-		NcValues *snowVals = snowVar->values();
-		NcValues *snowncVals = snowncVar->values();
-		NcValues *raincVals = raincVar->values();
-		NcValues *rainncVals = rainncVar->values();
-		NcValues *sfroffVals = sfroffVar->values();
-		NcValues *udroffVals = udroffVar->values();
+	if (cellBinCols == 0) return false;
+	if (x < xMin || x > xMax || y < yMin || y > yMax) return false;
 
-		long fileOffset = fileNum * timeSize * recSize;
-		// go through each timestep
-		for (int timeStep = 0; timeStep < timeSize; timeStep++) {
-			long timeOffset = timeStep * recSize;
-			// go through each coordinate
-			for (int i = 0; i < recSize; i++) {
-				long varOffset, recOffset = timeOffset + i;
-				long totalOffset = fileOffset + recOffset;
-
-				// hack to make corrupt data file work
-				if (fileNum == 29 && timeStep > 3) varOffset = 3 * recSize + i;
-				else varOffset = recOffset;
-
-				// accumulate the data in reverse order
-				snowpackData[totalOffset] = snowVals->as_float(varOffset);
-				snowfallData[totalOffset] = snowncVals->as_float(varOffset);
-				precipitationData[totalOffset] = raincVals->as_float(varOffset) + rainncVals->as_float(varOffset);
-				runoffData[totalOffset] = sfroffVals->as_float(varOffset) + udroffVals->as_float(varOffset);
-			}
+	int binCol = (int)((x - xMin) / cellBinWidth);
+	int binRow = (int)((y - yMin) / cellBinHeight);
+	if (binCol >= cellBinCols) binCol = cellBinCols - 1;
+	if (binRow >= cellBinRows) binRow = cellBinRows - 1;
+	int bin = binRow * cellBinCols + binCol;
+
+	// only the few cells overlapping this bin can hold the point
+	for (int k = cellBinStart[bin]; k < cellBinStart[bin + 1]; k++) {
+		if (pointInCell(x, y, cellBinCells[k])) {
+			index = cellBinCells[k];
+			return true;
 		}
 	}
-	return;
+	return false;
 }
 
-// get the data for one shape file
-int getShapeFileData(int fileNum, char *fileName) {
-	int nEntities, shapeType, totalParts = 0, totalPoints = 0;
-	double minCoords[4], maxCoords[4];
+// checks if (x,y) is inside or on the cell with lower left corner index. The
+// cells are convex, so the point must be on the same side of all 4 edges.
+bool pointInCell(float x, float y, int index) {
+	int pointsPerRow = numCols * 2;
+	// corners in order around the cell
+	int corner[4] = {index, index + 2, index + pointsPerRow + 2, index + pointsPerRow};
+	bool hasPos = false, hasNeg = false;
+
+	for (int k = 0; k < 4; k++) {
+		int a = corner[k], b = corner[(k + 1) % 4];
+		float ex = weatherCoords[b] - weatherCoords[a];
+		float ey = weatherCoords[b + 1] - weatherCoords[a + 1];
+		float cross = ex * (y - weatherCoords[a + 1]) - ey * (x - weatherCoords[a]);
+
+		if (cross > 0.0) hasPos = true;
+		else if (cross < 0.0) hasNeg = true;
+		if (hasPos && hasNeg) return false;
+	}
+	return true;
+}
 
-	// initialize vectors for this file
-	shapeCoords.push_back(floatVectorVector);
-	partOffsets.push_back(intVectorVector);
+// gets the range of bins covered by [lo,hi] along one axis
+void cellBinRange(float lo, float hi, float origin, float size, int numBins, int &first, int &last) {
+	first = (int)((lo - origin) / size);
+	last = (int)((hi - origin) / size);
+	if (first < 0) first = 0;
+	if (last >= numBins) last = numBins - 1;
+	return;
+}
 
-	// get a handle for the shapefile
-	SHPHandle hSHP = SHPOpen(fileName, "rb");
-	// return error if file is not valid
-	if (hSHP == NULL) {
-		//fprintf(stderr, "Error: %s is not a shapefile. Skipping\n", fileName);
-		return -1;
+// Buckets every cell of the grid by its bounding box. There's about one bin per
+// cell, so a lookup only has to test a handful of cells.
+void buildCellIndex(void) {
+	int pointsPerRow = numCols * 2;
+	int numCells = (numRows - 1) * (numCols - 1);
+	if (numCells <= 0) return;
+
+	cellBinCols = numCols - 1;
+	cellBinRows = numRows - 1;
+	cellBinWidth = (xMax - xMin) / cellBinCols;
+	cellBinHeight = (yMax - yMin) / cellBinRows;
+	if (cellBinWidth <= 0.0) cellBinWidth = 1.0;
+	if (cellBinHeight <= 0.0) cellBinHeight = 1.0;
+
+	int numBins = cellBinCols * cellBinRows;
+	vector<int> counts(numBins + 1, 0);
+	vector<int>(numBins + 1, 0).swap(cellBinStart);
+
+	// two passes, count the cells in each bin and then fill them in
+	for (int pass = 0; pass < 2; pass++) {
+		for (int row = 0; row < numRows - 1; row++) {
+			for (int col = 0; col < numCols - 1; col++) {
+				int i = row * pointsPerRow + col * 2;
+				int corner[4] = {i, i + 2, i + pointsPerRow + 2, i + pointsPerRow};
+				float cxMin = MAX_FLOAT, cxMax = -MAX_FLOAT;
+				float cyMin = MAX_FLOAT, cyMax = -MAX_FLOAT;
+				for (int k = 0; k < 4; k++) {
+					cxMin = min(cxMin, weatherCoords[corner[k]]);
+					cxMax = max(cxMax, weatherCoords[corner[k]]);
+					cyMin = min(cyMin, weatherCoords[corner[k] + 1]);
+					cyMax = max(cyMax, weatherCoords[corner[k] + 1]);
+				}
+
+				int firstCol, lastCol, firstRow, lastRow;
+				cellBinRange(cxMin, cxMax, xMin, cellBinWidth, cellBinCols, firstCol, lastCol);
+				cellBinRange(cyMin, cyMax, yMin, cellBinHeight, cellBinRows, firstRow, lastRow);
+
+				for (int r = firstRow; r <= lastRow; r++) {
+					for (int c = firstCol; c <= lastCol; c++) {
+						int bin = r * cellBinCols + c;
+						if (pass == 0) cellBinStart[bin + 1]++;
+						else cellBinCells[cellBinStart[bin] + counts[bin]++] = i;
+					}
+				}
+			}
+		}
+
+		if (pass == 0) {
+			// turn the counts into offsets
+			for (int b = 0; b < numBins; b++) cellBinStart[b + 1] += cellBinStart[b];
+			vector<int>(cellBinStart[numBins]).swap(cellBinCells);
+		}
 	}
-	SHPGetInfo(hSHP, &nEntities, &shapeType, minCoords, maxCoords);
-	
-	// good debug info
+
 	#ifdef CONSOLE_OUTPUT
-	printf("Processing shapefile[%d] %s\n", fileNum, fileName);
+	printf("Indexed %d cells in %d x %d bins\n", numCells, cellBinCols, cellBinRows);
 	#endif
+	return;
+}
 
-	// go though all the entities
-	for (int currEntity = 0; currEntity < nEntities; currEntity++) {
-		// initialize vectors
-		partOffsets[fileNum].push_back(intVector);
-		shapeCoords[fileNum].push_back(floatVector);
-
-		// get a reference to the current object
-		SHPObject *sObj = SHPReadObject(hSHP, currEntity);
-		
-		#ifdef DEBUG2
-		printf("type = %d id = %d, parts = %d nVertices = %d\n",
-			   	sObj->nSHPType, sObj->nShapeId, sObj->nParts, sObj->nVerticed);
-		#endif
-
-		// get the offsets for each part separately
-		for (int currPart = 0; currPart < sObj->nParts; currPart++) {
-			partOffsets[fileNum][currEntity].push_back(sObj->panPartStart[currPart]);
-			#ifdef DEBUG2
-			printf("Processing entity %d, part %d ", currEntity, currPart);
-			printf("panPartStart[%d] = %d\n", currPart, sObj->panPartStart[currPart]);
-			#endif
+// Walks from the cell with lower left corner index toward (x,y), each step
+// crossing the edge the point is furthest outside of, until the cell holding
+// the point is found. Returns false if the walk leaves the grid.
+bool walkToCell(float x, float y, int &index) {
+	int pointsPerRow = numCols * 2;
+	int row = index / pointsPerRow;
+	int col = (index % pointsPerRow) / 2;
+	// a walk along a straight line never needs more steps than this
+	int maxSteps = 2 * (numRows + numCols);
+
+	for (int step = 0; step < maxSteps; step++) {
+		int i = row * pointsPerRow + col * 2;
+		// corners in order around the cell: bottom, right, top, left edges
+		int corner[4] = {i, i + 2, i + pointsPerRow + 2, i + pointsPerRow};
+		float cross[4];
+		float area = 0.0;
+
+		for (int k = 0; k < 4; k++) {
+			int a = corner[k], b = corner[(k + 1) % 4];
+			float ex = weatherCoords[b] - weatherCoords[a];
+			float ey = weatherCoords[b + 1] - weatherCoords[a + 1];
+			float len = sqrt(ex*ex + ey*ey);
+			// distance of the point from the edge, positive on the inside of a
+			// counterclockwise cell
+			cross[k] = (ex * (y - weatherCoords[a + 1]) - ey * (x - weatherCoords[a]));
+			if (len > 0.0) cross[k] /= len;
+			area += weatherCoords[a] * weatherCoords[b + 1] - weatherCoords[b] * weatherCoords[a + 1];
 		}
-		// make sure the get the last index so we know where to stop for the final part
-		partOffsets[fileNum][currEntity].push_back(sObj->nVertices);
 
-		// get the vertex data for the entire entity
-		for (int currVertex = 0; currVertex < sObj->nVertices; currVertex++) {
-			// interleave (x,y) coords; this actually makes it easier to render
-			shapeCoords[fileNum][currEntity].push_back(sObj->padfX[currVertex]);
-			shapeCoords[fileNum][currEntity].push_back(sObj->padfY[currVertex]);
+		// find the edge the point is furthest outside of
+		int edge = -1;
+		float worst = 0.0;
+		for (int k = 0; k < 4; k++) {
+			float d = (area < 0.0) ? -cross[k] : cross[k];
+			if (d < worst) {
+				worst = d;
+				edge = k;
+			}
+		}
 
-			totalPoints++;
+		if (edge == -1) {
+			index = i;
+			return true;
+		}
 
-			#ifdef DEBUG2
-			printf("\tx[%d] = %f, y[%d] = %f\n",
-				   	currVertex, sObj->padfX[currVertex], currVertex, sObj->padfY[currVertex]);
-			#endif
+		// step into the neighbor across that edge
+		switch (edge) {
+			case 0: row--; break;
+			case 1: col++; break;
+			case 2: row++; break;
+			case 3: col--; break;
 		}
-		totalParts += sObj->nParts;
-		
-		SHPDestroyObject(sObj);
+		if (row < 0 || row >= numRows - 1 || col < 0 || col >= numCols - 1) return false;
 	}
-	
-	#ifdef DEBUG2
-	printf("File %d has %d entities, %d total parts and %d total points\n",
-		   	fileNum, nEntities, totalParts, totalPoints);
-	#endif
-	
-	SHPClose(hSHP);
-	return 0;
+
+	// the walk went in circles, fall back to the index
+	return findFirstCell(x, y, index);
 }
 
-void jpeg2texture(int texNum, char *imageName) {
-	GLuint success = 0;
-	
-	success = ilutGLLoadImage(imageName);
-	// check for error
-	if (ilGetError()) {
-		printf("Error was: %s\n", iluErrorString(ilGetError()));
-		return;
-	}
+// Finds the cell holding each of the sdsize samples along the slice line in
+// one pass. Each sample walks from the previous sample's cell, so the cost is
+// the number of cells crossed. Samples off the grid get -1.
+void traceSliceCells(int *cells, int sdsize) {
+	int index = 0;
+	bool insideGraph = false;
 
-	// if the image was loaded successfully
-	if (success) {
-		success = ilConvertImage(IL_RGB, IL_UNSIGNED_BYTE);
-	   	if (!success) {
-			#ifndef ERROR_NOTIFICATION_OFF
-			fprintf(stderr, "Error converting image \"%s\".\n", imageName);
-			#endif
-		   	return;
-		}
-		// bind this texture to a number
-		glBindTexture(GL_TEXTURE_2D, textures[texNum]);
+	for (int sliceStep = 0; sliceStep < sdsize; sliceStep++) {
+		float t = (float)sliceStep / sdsize;
+		float x = (1-t)*lineStart.x + t*lineEnd.x;
+		float y = (1-t)*lineStart.y + t*lineEnd.y;
 
-		// TODO: see if these are the parameters we really want
-	   	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	   	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		if (insideGraph) insideGraph = walkToCell(x, y, index);
+		// the line may enter(or re-enter) the grid anywhere
+		if (!insideGraph) insideGraph = findFirstCell(x, y, index);
 
-		// declare texture attributes
-	   	glTexImage2D(GL_TEXTURE_2D, 0, ilGetInteger(IL_IMAGE_BPP), ilGetInteger(IL_IMAGE_WIDTH),
-			   	ilGetInteger(IL_IMAGE_HEIGHT), 0, ilGetInteger(IL_IMAGE_FORMAT), GL_UNSIGNED_BYTE, ilGetData());
-   	} 
+		cells[sliceStep] = insideGraph ? index : -1;
+	}
 	return;
 }
 
-void parseImageLocation(char *fileName) {
-	int i = 0;
-	float num;
-	coord_t texCoord;
+// Reads numRecs records of the blockRows x blockCols block at(firstRow,firstCol)
+// of the variable name, starting at firstRec, straight into dest with a single
+// hyperslab read. Variables are (Time, south_north, west_east).
+// netCDF isn't thread safe, so threads take turns at the library. The ingest
+// reads in parallel with processes instead, see runIngestWorkers().
+bool readNcVar(NcFile *ncF, const char *name, long firstRec, long numRecs,
+		int firstRow, int blockRows, int firstCol, int blockCols, float *dest) {
+	pthread_mutex_lock(&ncMutex);
+	NcVar *var = ncF->get_var(name);
+	bool success = var != NULL && var->set_cur(firstRec, firstRow, firstCol) &&
+			var->get(dest, numRecs, blockRows, blockCols);
+	pthread_mutex_unlock(&ncMutex);
+	return success;
+}
 
-	// get the longitude
-	while((fileName[i] != 'W') && (fileName[i] != 'E')) i++;
-	num = atof(fileName + i + 1);
+// dest[i] += src[i], written so the compiler vectorizes it
+void addRecords(float * __restrict dest, const float * __restrict src, long size) {
+	for (long i = 0; i < size; i++) {
+		dest[i] += src[i];
+	}
+	return;
+}
 
-	// west longitudes are actually negative
-	if (fileName[i] == 'W') texCoord.x = -num;
-	else if (fileName[i] == 'E') texCoord.x = num;
-	else {
-		// error
-		#ifndef ERROR_NOTIFICATION_OFF
-		cerr << "Error: Malformed filename. Should be: path/[E|W]<number>[N|S]<number>.jpg" << endl;
-		#endif
-		return;
+// Reads numRecs records starting at firstRec of every attribute from one Ncfile.
+// Any of the attribute pointers may be NULL to skip that attribute. scratch must
+// hold numRecs * recSize floats; it's needed for the combined fields.
+bool readNcRecords(NcFile *ncF, int fileNum, long firstRec, long numRecs,
+		float *snowpack, float *snowfall, float *precipitation, float *runoff, float *scratch) {
+	float *attrs[4] = {snowpack, snowfall, precipitation, runoff};
+	return readNcArea(ncF, fileNum, firstRec, numRecs, 0, numRows, 0, numCols, attrs, scratch);
+}
+
+// readNcRecords() for just the blockRows x blockCols block at(firstRow,firstCol),
+// attrs[attr] and scratch hold numRecs * blockRows * blockCols floats
+bool readNcArea(NcFile *ncF, int fileNum, long firstRec, long numRecs,
+		int firstRow, int blockRows, int firstCol, int blockCols, float **attrs, float *scratch) {
+	long blockSize = (long)blockRows * blockCols;
+	float *snowpack = attrs[0], *snowfall = attrs[1], *precipitation = attrs[2], *runoff = attrs[3];
+	long readFirst = firstRec, readRecs = numRecs;
+	bool success = true;
+
+	// hack to make corrupt data file work: records after 3 in file 29 are
+	// garbage, so record 3 gets repeated in their place
+	if (fileNum == 29 && firstRec + numRecs - 1 > 3) {
+		if (firstRec > 3) {
+			readFirst = 3;
+			readRecs = 1;
+		}
+		else readRecs = 4 - firstRec;
 	}
+	long readSize = readRecs * blockSize;
 
-	// get the latitude
-	while((fileName[i] != 'S') && (fileName[i] != 'N')) i++;
-	num = atof(fileName + i + 1);
+	if (snowpack != NULL) {
+		success &= readNcVar(ncF, "SNOW", readFirst, readRecs,
+				firstRow, blockRows, firstCol, blockCols, snowpack);
+	}
+	if (snowfall != NULL) {
+		success &= readNcVar(ncF, "SNOWNC", readFirst, readRecs,
+				firstRow, blockRows, firstCol, blockCols, snowfall);
+	}
+	// RAINC+RAINNC: precipitation
+	if (precipitation != NULL) {
+		success &= readNcVar(ncF, "RAINC", readFirst, readRecs,
+				firstRow, blockRows, firstCol, blockCols, precipitation);
+		success &= readNcVar(ncF, "RAINNC", readFirst, readRecs,
+				firstRow, blockRows, firstCol, blockCols, scratch);
+		addRecords(precipitation, scratch, readSize);
+	}
+	// SFROFF+UDROFF: runoff
+	if (runoff != NULL) {
+		success &= readNcVar(ncF, "SFROFF", readFirst, readRecs,
+				firstRow, blockRows, firstCol, blockCols, runoff);
+		success &= readNcVar(ncF, "UDROFF", readFirst, readRecs,
+				firstRow, blockRows, firstCol, blockCols, scratch);
+		addRecords(runoff, scratch, readSize);
+	}
+
+	// fill in the records the corrupt data hack skipped
+	for (long rec = readRecs; rec < numRecs; rec++) {
+		for (int attr = 0; attr < 4; attr++) {
+			if (attrs[attr] == NULL) continue;
+			memcpy(attrs[attr] + rec * blockSize, attrs[attr] + (readRecs - 1) * blockSize,
+					blockSize * sizeof(float));
+		}
+	}
+	return success;
+}
+
+// Memory that stays shared with the processes forked after it's allocated
+void *sharedAlloc(size_t size) {
+	void *map = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (map == MAP_FAILED) {
+		#ifndef ERROR_NOTIFICATION_OFF
+		fprintf(stderr, "Error: Couldn't allocate %.0f MB of shared memory. Aborting.\n",
+				size / (1024.0 * 1024.0));
+		#endif
+		exit(1);
+	}
+	return map;
+}
+
+// Runs work on every Ncfile with a pool of worker processes(-j), handing the
+// files out one at a time since they're different sizes on disk. netCDF isn't
+// thread safe, so threads could only take turns reading; processes each have
+// their own copy of the library. Whatever work writes must be in memory from
+// sharedAlloc(). buffer is bufferSize floats of the worker's own. failed is set
+// for every file work failed on, or whose worker died.
+void runIngestWorkers(ncfilework_t work, long bufferSize, char **fileList,
+		float *fileMins, float *fileMaxs, vector<char> &failed) {
+	int numWorkers = (numIngestThreads > 0) ? numIngestThreads : sysconf(_SC_NPROCESSORS_ONLN);
+	numWorkers = max(1, min(numWorkers, numNcFiles));
+
+	// the next file to hand out, then 0(not done), 1(read) or 2(failed) per file
+	size_t sharedSize = sizeof(int) + numNcFiles;
+	char *shared = (char *)sharedAlloc(sharedSize);
+	int *nextFile = (int *)shared;
+	char *status = shared + sizeof(int);
+
+	#ifdef CONSOLE_OUTPUT
+	printf("Ingesting with %d worker processes.\n", numWorkers);
+	#endif
+
+	int numRunning = 0;
+	for (int i = 0; i < numWorkers; i++) {
+		if (forkIngestWorker(work, bufferSize, fileList, fileMins, fileMaxs, nextFile, status) > 0) {
+			numRunning++;
+		}
+	}
+	// without workers the files are read right here
+	if (numRunning == 0) {
+		#ifndef ERROR_NOTIFICATION_OFF
+		fprintf(stderr, "Error: Couldn't start the ingest workers, ingesting one file at a time.\n");
+		#endif
+		ingestWorker(work, bufferSize, fileList, fileMins, fileMaxs, nextFile, status);
+	}
+
+	while (numRunning > 0) {
+		int exitStatus;
+		pid_t pid = wait(&exitStatus);
+		if (pid < 0) {
+			if (errno == EINTR) continue;
+			break;
+		}
+		numRunning--;
+		if (WIFEXITED(exitStatus) && WEXITSTATUS(exitStatus) == 0) continue;
+
+		// a worker that crashed takes its file with it, the rest still need reading
+		#ifndef ERROR_NOTIFICATION_OFF
+		fprintf(stderr, "Error: An ingest worker died.\n");
+		#endif
+		if (*nextFile >= numNcFiles) continue;
+		if (forkIngestWorker(work, bufferSize, fileList, fileMins, fileMaxs, nextFile, status) > 0) {
+			numRunning++;
+		}
+		else ingestWorker(work, bufferSize, fileList, fileMins, fileMaxs, nextFile, status);
+	}
+
+	failed.assign(numNcFiles, 0);
+	for (int fileNum = 0; fileNum < numNcFiles; fileNum++) failed[fileNum] = status[fileNum] != 1;
+	munmap(shared, sharedSize);
+	return;
+}
+
+// starts a process running ingestWorker(), returns its pid or -1
+pid_t forkIngestWorker(ncfilework_t work, long bufferSize, char **fileList,
+		float *fileMins, float *fileMaxs, int *nextFile, char *status) {
+	// otherwise the worker prints what's still buffered again
+	fflush(stdout);
+	fflush(stderr);
+	pid_t pid = fork();
+	if (pid == 0) {
+		ingestWorker(work, bufferSize, fileList, fileMins, fileMaxs, nextFile, status);
+		fflush(stdout);
+		// skip the parent's atexit cleanup
+		_exit(0);
+	}
+	return pid;
+}
+
+// one worker of runIngestWorkers()
+void ingestWorker(ncfilework_t work, long bufferSize, char **fileList,
+		float *fileMins, float *fileMaxs, int *nextFile, char *status) {
+	float *buffer = new float[bufferSize];
+	while (true) {
+		int fileNum = __sync_fetch_and_add(nextFile, 1);
+		if (fileNum >= numNcFiles) break;
+		status[fileNum] = work(fileNum, fileList, fileMins, fileMaxs, buffer) ? 1 : 2;
+	}
+	delete [] buffer;
+	return;
+}
+
+// Reads every timestep of one file straight into its fileOffset slice of the
+// attribute arrays and finds its maxs and mins while it's still in cache.
+// buffer holds timeSize * recSize floats, for summing the combined fields.
+bool ingestNcFile(int fileNum, char **fileList, float *fileMins, float *fileMaxs, float *buffer) {
+	char *fileName = fileList[fileNum];
+	long fileOffset = fileNum * timeSize * recSize;
+	float *attrs[4] = {snowpackData + fileOffset, snowfallData + fileOffset,
+			precipitationData + fileOffset, runoffData + fileOffset};
+
+	pthread_mutex_lock(&ncMutex);
+	NcFile *ncF = new NcFile(fileName);
+	pthread_mutex_unlock(&ncMutex);
+	// make sure the file is valid
+	if (!ncF->is_valid()) {
+		#ifndef ERROR_NOTIFICATION_OFF
+		printf("Error: %s is not a valid Ncfile.\n", fileName);
+		#endif
+		pthread_mutex_lock(&ncMutex);
+		delete ncF;
+		pthread_mutex_unlock(&ncMutex);
+		return false;
+	}
+
+	#ifdef CONSOLE_OUTPUT
+	int startPos = 0;
+	// strip the prefix off the filename; it's ugly
+	for (int i = 0; i < strlen(fileName); i++) {
+		if (fileName[i] == '/') startPos = i + 1;
+	}
+	// check for index error
+	if (startPos > strlen(fileName) - 1) startPos = 0;
+	printf("Processing Ncfile[%d]: %s\n", fileNum, fileName + startPos);
+	#endif
+
+	// read every timestep of this file into its slice in one call per variable
+	bool success = readNcRecords(ncF, fileNum, 0, timeSize,
+			attrs[0], attrs[1], attrs[2], attrs[3], buffer);
+	if (success) {
+		reduceMaxsAndMins(attrs, NULL, timeSize, fileMins + 8 * fileNum, fileMaxs + 8 * fileNum);
+	}
+	#ifndef ERROR_NOTIFICATION_OFF
+	else printf("Error: Couldn't read all variables from %s.\n", fileName);
+	#endif
+
+	pthread_mutex_lock(&ncMutex);
+	delete ncF;
+	pthread_mutex_unlock(&ncMutex);
+	return success;
+}
+
+// Each file is written straight into its own fileOffset slice of the
+// attribute arrays, so the files are handed out to a pool of workers and
+// ingested at the same time. A file that can't be read is left zeroed;
+// returns false if any were, so the caller doesn't cache the gap.
+bool getNcFileData(char **fileList) {
+	float *fileMins, *fileMaxs;
+	allocateFileMaxsAndMins(&fileMins, &fileMaxs);
+
+	vector<char> failed;
+	runIngestWorkers(ingestNcFile, timeSize * recSize, fileList, fileMins, fileMaxs, failed);
+
+	// whatever part of a failed file was read doesn't go in the maxs and mins either
+	int numFailed = 0;
+	for (int fileNum = 0; fileNum < numNcFiles; fileNum++) {
+		if (!failed[fileNum]) continue;
+		long fileOffset = fileNum * timeSize * recSize;
+		float *attrs[4] = {snowpackData + fileOffset, snowfallData + fileOffset,
+				precipitationData + fileOffset, runoffData + fileOffset};
+		for (int attr = 0; attr < 4; attr++) {
+			memset(attrs[attr], 0, timeSize * recSize * sizeof(float));
+		}
+		excludeFileMaxsAndMins(fileMins, fileMaxs, fileNum);
+		numFailed++;
+	}
+
+	// the daily deltas into the first timestep of each file need the file
+	// before it, which might not have been read yet by the same worker. A
+	// failed file has no first timestep, or none to take a delta from.
+	#pragma omp parallel for
+	for (int fileNum = 1; fileNum < numNcFiles; fileNum++) {
+		if (failed[fileNum] || failed[fileNum - 1]) continue;
+		long fileOffset = fileNum * timeSize * recSize;
+		float *attrs[4] = {snowpackData + fileOffset, snowfallData + fileOffset,
+				precipitationData + fileOffset, runoffData + fileOffset};
+		float *prevAttrs[4] = {attrs[0] - recSize, attrs[1] - recSize,
+				attrs[2] - recSize, attrs[3] - recSize};
+		reduceMaxsAndMins(attrs, prevAttrs, 1, fileMins + 8 * fileNum, fileMaxs + 8 * fileNum);
+	}
+
+	mergeMaxsAndMins(fileMins, fileMaxs, numNcFiles);
+	freeFileMaxsAndMins(fileMins, fileMaxs);
+	return numFailed == 0;
+}
+
+// FNV-1a hash of the input file names, sizes and modification times, so any
+// change to the list of Ncfiles invalidates the cache
+unsigned long long ncFileSignature(char **fileList) {
+	unsigned long long hash = 14695981039346656037ULL;
+	struct stat st;
+
+	for (int fileNum = 0; fileNum < numNcFiles; fileNum++) {
+		long long fields[2] = {-1, -1};
+		if (stat(fileList[fileNum], &st) == 0) {
+			fields[0] = (long long)st.st_size;
+			fields[1] = (long long)st.st_mtime;
+		}
+
+		const unsigned char *name = (const unsigned char *)fileList[fileNum];
+		// include the terminating null so "ab","c" differs from "a","bc"
+		int nameLength = strlen(fileList[fileNum]) + 1;
+		for (int i = 0; i < nameLength; i++) {
+			hash = (hash ^ name[i]) * 1099511628211ULL;
+		}
+		const unsigned char *bytes = (const unsigned char *)fields;
+		for (int i = 0; i < sizeof(fields); i++) {
+			hash = (hash ^ bytes[i]) * 1099511628211ULL;
+		}
+	}
+	return hash;
+}
+
+// Maps the cache file straight into weatherCoords and the attribute arrays.
+// Returns false if there is no cache or it doesn't match the input files.
+bool loadWeatherCache(char **fileList) {
+	if (weatherCachePath == NULL) return false;
+
+	int fd = open(weatherCachePath, O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	cacheheader_t header;
+	if (fstat(fd, &st) != 0 || st.st_size < sizeof(header) ||
+			read(fd, &header, sizeof(header)) != sizeof(header)) {
+		close(fd);
+		return false;
+	}
+
+	// make sure the cache was written for this exact set of files
+	long dataSize = header.numNcFiles * header.timeSize * header.recSize;
+	if (memcmp(header.magic, WEATHER_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+			header.version != WEATHER_CACHE_VERSION ||
+			header.numNcFiles != numNcFiles ||
+			header.signature != ncFileSignature(fileList) ||
+			st.st_size != header.dataOffset + 4 * dataSize * sizeof(float)) {
+		#ifdef CONSOLE_OUTPUT
+		printf("Weather cache %s is out of date. Rebuilding it.\n", weatherCachePath);
+		#endif
+		close(fd);
+		return false;
+	}
+
+	// shared, so every viewer on this machine uses the same pages
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return false;
+
+	weatherCacheMap = map;
+	weatherCacheSize = st.st_size;
+
+	numRows = header.numRows;
+	numCols = header.numCols;
+	timeSize = header.timeSize;
+	recSize = header.recSize;
+	totalTimeSteps = numNcFiles * timeSize;
+	for (int i = 0; i <= RUNOFF_DAILY; i++) {
+		weatherAttrMin[i] = header.attrMin[i];
+		weatherAttrMax[i] = header.attrMax[i];
+	}
+
+	char *base = (char *)map;
+	weatherCoords = (float *)(base + sizeof(header));
+	snowpackData = (float *)(base + header.dataOffset);
+	snowfallData = snowpackData + dataSize;
+	precipitationData = snowfallData + dataSize;
+	runoffData = precipitationData + dataSize;
+
+	#ifdef CONSOLE_OUTPUT
+	printf("Loaded weather data from cache %s.\n", weatherCachePath);
+	#endif
+	return true;
+}
+
+// Writes the ingested data to the cache. The file is written under a temporary
+// name and renamed so a viewer starting at the same time never sees half of it.
+void writeWeatherCache(char **fileList) {
+	if (weatherCachePath == NULL) return;
+
+	cacheheader_t header;
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, WEATHER_CACHE_MAGIC, sizeof(header.magic));
+	header.version = WEATHER_CACHE_VERSION;
+	header.numRows = numRows;
+	header.numCols = numCols;
+	header.numNcFiles = numNcFiles;
+	header.timeSize = timeSize;
+	header.recSize = recSize;
+	header.signature = ncFileSignature(fileList);
+	for (int i = 0; i <= RUNOFF_DAILY; i++) {
+		header.attrMin[i] = weatherAttrMin[i];
+		header.attrMax[i] = weatherAttrMax[i];
+	}
+	// page align the attribute arrays
+	long pageSize = sysconf(_SC_PAGESIZE);
+	long coordsEnd = sizeof(header) + 2 * recSize * sizeof(float);
+	header.dataOffset = ((coordsEnd + pageSize - 1) / pageSize) * pageSize;
+
+	string tmpPath = string(weatherCachePath) + ".tmp";
+	FILE *fout = fopen(tmpPath.c_str(), "wb");
+	if (fout == NULL) {
+		#ifndef ERROR_NOTIFICATION_OFF
+		fprintf(stderr, "Error: Couldn't write weather cache %s.\n", tmpPath.c_str());
+		#endif
+		return;
+	}
+
+	long dataSize = numNcFiles * timeSize * recSize;
+	float *attrs[4] = {snowpackData, snowfallData, precipitationData, runoffData};
+	bool success = fwrite(&header, sizeof(header), 1, fout) == 1;
+	success &= fwrite(weatherCoords, sizeof(float), 2 * recSize, fout) == 2 * recSize;
+	success &= fseek(fout, header.dataOffset, SEEK_SET) == 0;
+	for (int attr = 0; attr < 4; attr++) {
+		success &= fwrite(attrs[attr], sizeof(float), dataSize, fout) == dataSize;
+	}
+	success &= fclose(fout) == 0;
+
+	if (!success || rename(tmpPath.c_str(), weatherCachePath) != 0) {
+		#ifndef ERROR_NOTIFICATION_OFF
+		fprintf(stderr, "Error: Couldn't write weather cache %s.\n", weatherCachePath);
+		#endif
+		unlink(tmpPath.c_str());
+		return;
+	}
+
+	#ifdef CONSOLE_OUTPUT
+	printf("Wrote weather cache %s.\n", weatherCachePath);
+	#endif
+	return;
+}
+
+// maps any weather attribute, daily or not, to the data it is computed from
+int dataAttribute(int attrNum) {
+	if (attrNum == OBSERVED_SNOWPACK) return OBSERVED_DATA;
+	return attrNum % 4;
+}
+
+// the daily attributes are colored and graphed by their change since the last timestep
+bool isDailyAttribute(int attrNum) {
+	return attrNum >= SNOWPACK_DAILY && attrNum <= RUNOFF_DAILY;
+}
+
+// Returns the record of attr (SNOWPACK..RUNOFF) at timeStep. In streaming mode
+// this blocks if the timestep hasn't been loaded yet. The pointer stays valid
+// until the playback position moves half a window, so only call this from the
+// GLUT thread.
+float *getTimeStep(int attr, int timeStep) {
+	if (attr == OBSERVED_DATA) return observedTimeStep(timeStep);
+	if (!streaming) {
+		float *attrs[4] = {snowpackData, snowfallData, precipitationData, runoffData};
+		return attrs[attr] + (long)timeStep * recSize;
+	}
+
+	int slot = timeStep % streamWindow;
+	float *slotData = streamData + (long)slot * 4 * recSize;
+
+	pthread_mutex_lock(&streamMutex);
+	// wait for the loader if it's filling this slot
+	while (streamSlotLoading[slot]) pthread_cond_wait(&streamCond, &streamMutex);
+	if (streamSlotStep[slot] != timeStep) {
+		// a miss, load it ourselves
+		streamSlotStep[slot] = timeStep;
+		streamSlotLoading[slot] = true;
+		pthread_mutex_unlock(&streamMutex);
+
+		#ifdef CONSOLE_OUTPUT
+		printf("Timestep %d wasn't prefetched, loading it now.\n", timeStep);
+		#endif
+		fetchstate_t fetch;
+		openFetch(fetch);
+		bool success = loadStreamStep(timeStep, fetch);
+		closeFetch(fetch);
+
+		pthread_mutex_lock(&streamMutex);
+		finishStreamLoad(timeStep, success);
+	}
+	pthread_mutex_unlock(&streamMutex);
+
+	return slotData + (long)attr * recSize;
+}
+
+// allocates the ring buffer used instead of the full attribute arrays
+void allocateStreamSpace(void) {
+	if (streamWindow > totalTimeSteps) streamWindow = totalTimeSteps;
+	// need the current and previous timestep plus something to prefetch
+	if (streamWindow < 4) streamWindow = 4;
+
+	streamData = new float[(long)streamWindow * 4 * recSize];
+	streamSlotStep = new int[streamWindow];
+	streamSlotLoading = new bool[streamWindow];
+	for (int slot = 0; slot < streamWindow; slot++) {
+		streamSlotStep[slot] = -1;
+		streamSlotLoading[slot] = false;
+	}
+	streamStepFailed.assign(totalTimeSteps, 0);
+
+	#ifdef CONSOLE_OUTPUT
+	printf("Streaming %d timesteps at a time (%.1f MB).\n", streamWindow,
+			streamWindow * 4.0 * recSize * sizeof(float) / (1024.0 * 1024.0));
+	#endif
+	return;
+}
+
+// Loads every attribute of timeStep into its ring slot, which the caller must
+// have marked as loading.
+bool loadStreamStep(int timeStep, fetchstate_t &fetch) {
+	int fileNum = timeStep / timeSize;
+	long rec = timeStep % timeSize;
+
+	if (!openStreamFile(fileNum, fetch)) return false;
+
+	float *slotData = streamData + (long)(timeStep % streamWindow) * 4 * recSize;
+	return readNcRecords(fetch.openFile, fileNum, rec, 1, slotData, slotData + recSize,
+			slotData + 2 * recSize, slotData + 3 * recSize, fetch.scratch);
+}
+
+// Makes fetch.openFile the Ncfile fileNum, reusing it if it's already open
+bool openStreamFile(int fileNum, fetchstate_t &fetch) {
+	if (fetch.openFileNum != fileNum) {
+		pthread_mutex_lock(&ncMutex);
+		delete fetch.openFile;
+		fetch.openFile = new NcFile(ncFileNames[fileNum]);
+		pthread_mutex_unlock(&ncMutex);
+		fetch.openFileNum = fileNum;
+	}
+	return fetch.openFile->is_valid();
+}
+
+// sets up a thread's fetchstate_t, every openFetch() needs a closeFetch()
+void openFetch(fetchstate_t &fetch) {
+	fetch.record = fetch.scratch = NULL;
+	if (streaming) {
+		fetch.record = new float[recSize];
+		fetch.scratch = new float[recSize];
+	}
+	fetch.openFile = NULL;
+	fetch.openFileNum = -1;
+	return;
+}
+
+void closeFetch(fetchstate_t &fetch) {
+	pthread_mutex_lock(&ncMutex);
+	delete fetch.openFile;
+	pthread_mutex_unlock(&ncMutex);
+	delete [] fetch.record;
+	delete [] fetch.scratch;
+	return;
+}
+
+// Thread safe version of getTimeStep() for bulk passes over every timestep.
+// In streaming mode the record is read into fetch.record without touching the
+// ring buffer. Returns NULL if the record couldn't be read.
+const float *fetchTimeStep(int attr, int timeStep, fetchstate_t &fetch) {
+	if (attr == OBSERVED_DATA) return observedTimeStep(timeStep);
+	if (!streaming) {
+		float *attrs[4] = {snowpackData, snowfallData, precipitationData, runoffData};
+		return attrs[attr] + (long)timeStep * recSize;
+	}
+
+	int fileNum = timeStep / timeSize;
+	long rec = timeStep % timeSize;
+	if (!openStreamFile(fileNum, fetch)) return NULL;
+
+	float *dest[4] = {NULL, NULL, NULL, NULL};
+	dest[attr] = fetch.record;
+	if (!readNcRecords(fetch.openFile, fileNum, rec, 1, dest[0], dest[1], dest[2], dest[3], fetch.scratch)) {
+		return NULL;
+	}
+	return fetch.record;
+}
+
+// Background thread that keeps the half window ahead of the playback position
+// (and the timestep just behind it, for the daily attributes) resident.
+void *streamLoader(void *arg) {
+	fetchstate_t fetch;
+	openFetch(fetch);
+
+	pthread_mutex_lock(&streamMutex);
+	while (!streamStop) {
+		// find the closest timestep to the playback position that isn't resident
+		int next = -1;
+		for (int k = -1; k < streamWindow / 2; k++) {
+			int timeStep = streamCenter + k * streamDirection;
+			// the simulation wraps around at the ends
+			timeStep = (timeStep + totalTimeSteps) % totalTimeSteps;
+			int slot = timeStep % streamWindow;
+			if (streamSlotStep[slot] != timeStep && !streamSlotLoading[slot] &&
+					!streamStepFailed[timeStep]) {
+				next = timeStep;
+				break;
+			}
+		}
+		// everything is resident, sleep until playback moves
+		if (next == -1) {
+			pthread_cond_wait(&streamCond, &streamMutex);
+			continue;
+		}
+
+		int slot = next % streamWindow;
+		streamSlotStep[slot] = next;
+		streamSlotLoading[slot] = true;
+		pthread_mutex_unlock(&streamMutex);
+
+		bool success = loadStreamStep(next, fetch);
+
+		pthread_mutex_lock(&streamMutex);
+		finishStreamLoad(next, success);
+	}
+	pthread_mutex_unlock(&streamMutex);
+
+	closeFetch(fetch);
+	return NULL;
+}
+
+// Marks timeStep's slot as loaded, with streamMutex held. A failed load is
+// zeroed rather than left showing the timestep the slot held before, and the
+// slot is left empty so the timestep is loaded again when it's next asked for.
+void finishStreamLoad(int timeStep, bool success) {
+	int slot = timeStep % streamWindow;
+	if (!success) {
+		#ifndef ERROR_NOTIFICATION_OFF
+		fprintf(stderr, "Error: Couldn't load timestep %d.\n", timeStep);
+		#endif
+		memset(streamData + (long)slot * 4 * recSize, 0, 4 * recSize * sizeof(float));
+		streamSlotStep[slot] = -1;
+	}
+	streamStepFailed[timeStep] = !success;
+	streamSlotLoading[slot] = false;
+	pthread_cond_broadcast(&streamCond);
+	return;
+}
+
+void startStreamLoader(void) {
+	streamThreadStarted = pthread_create(&streamThread, NULL, streamLoader, NULL) == 0;
+	#ifndef ERROR_NOTIFICATION_OFF
+	if (!streamThreadStarted) {
+		fprintf(stderr, "Error: Couldn't start the stream loader. Timesteps will load on demand.\n");
+	}
+	#endif
+	return;
+}
+
+// moves the window the loader prefetches into
+void setStreamPosition(int timeStep, int direction) {
+	pthread_mutex_lock(&streamMutex);
+	streamCenter = timeStep;
+	streamDirection = direction;
+	pthread_cond_broadcast(&streamCond);
+	pthread_mutex_unlock(&streamMutex);
+	return;
+}
+
+// where the series of a grid point(row * numCols + col) starts in timeMajorData
+inline long timeMajorOffset(int point) {
+	int row = point / numCols, col = point % numCols;
+	long tile = (row / TILE_SIZE) * numTileCols + col / TILE_SIZE;
+	long inTile = (row % TILE_SIZE) * TILE_SIZE + col % TILE_SIZE;
+	return (tile * TILE_SIZE * TILE_SIZE + inTile) * totalTimeSteps;
+}
+
+// Background thread that transposes the attribute arrays into timeMajorData.
+// Blocks of timesteps are done a tile at a time so both the reads and the
+// writes stay in cache.
+void *buildTimeMajorLayout(void *arg) {
+	const int BLOCK_STEPS = 64;
+	float *attrs[4] = {snowpackData, snowfallData, precipitationData, runoffData};
+	long layoutSize = (long)numTileRows * numTileCols * TILE_SIZE * TILE_SIZE * totalTimeSteps;
+	float *layout[4] = {NULL, NULL, NULL, NULL};
+	bool stopped = false;
+
+	for (int attr = 0; attr < 4 && !stopped; attr++) {
+		layout[attr] = new float[layoutSize];
+
+		for (int tileRow = 0; tileRow < numTileRows && !stopped; tileRow++) {
+			int rowEnd = min(numRows, (tileRow + 1) * TILE_SIZE);
+			for (int tileCol = 0; tileCol < numTileCols; tileCol++) {
+				int colEnd = min(numCols, (tileCol + 1) * TILE_SIZE);
+
+				for (int t0 = 0; t0 < totalTimeSteps; t0 += BLOCK_STEPS) {
+					int t1 = min(totalTimeSteps, t0 + BLOCK_STEPS);
+					for (int row = tileRow * TILE_SIZE; row < rowEnd; row++) {
+						for (int col = tileCol * TILE_SIZE; col < colEnd; col++) {
+							int point = row * numCols + col;
+							float *series = layout[attr] + timeMajorOffset(point);
+							const float *src = attrs[attr] + point;
+							for (int t = t0; t < t1; t++) {
+								series[t] = src[(long)t * recSize];
+							}
+						}
+					}
+				}
+			}
+
+			pthread_mutex_lock(&timeMajorMutex);
+			stopped = timeMajorStop;
+			pthread_mutex_unlock(&timeMajorMutex);
+		}
+	}
+
+	pthread_mutex_lock(&timeMajorMutex);
+	if (!timeMajorStop) {
+		for (int attr = 0; attr < 4; attr++) timeMajorData[attr] = layout[attr];
+		timeMajorReady = true;
+	}
+	else {
+		for (int attr = 0; attr < 4; attr++) delete [] layout[attr];
+	}
+	pthread_mutex_unlock(&timeMajorMutex);
+
+	#ifdef CONSOLE_OUTPUT
+	if (!stopped) printf("Time-major layout ready.\n");
+	#endif
+	return NULL;
+}
+
+// Only called once the attribute arrays are complete. The layout is a second
+// copy of the run, so it's skipped when that won't fit in the free memory.
+void startTimeMajorBuilder(void) {
+	numTileCols = (numCols + TILE_SIZE - 1) / TILE_SIZE;
+	numTileRows = (numRows + TILE_SIZE - 1) / TILE_SIZE;
+
+	double layoutBytes = 4.0 * numTileRows * numTileCols * TILE_SIZE * TILE_SIZE *
+			totalTimeSteps * sizeof(float);
+	double freeBytes = (double)sysconf(_SC_AVPHYS_PAGES) * sysconf(_SC_PAGESIZE);
+	if (layoutBytes > freeBytes) {
+		#ifdef CONSOLE_OUTPUT
+		printf("Not building the time-major layout, it needs %.0f MB and only %.0f MB are free.\n",
+				layoutBytes / (1024.0 * 1024.0), freeBytes / (1024.0 * 1024.0));
+		#endif
+		return;
+	}
+
+	timeMajorThreadStarted = pthread_create(&timeMajorThread, NULL, buildTimeMajorLayout, NULL) == 0;
+	#ifndef ERROR_NOTIFICATION_OFF
+	if (!timeMajorThreadStarted) {
+		fprintf(stderr, "Error: Couldn't start the time-major layout builder.\n");
+	}
+	#endif
+	return;
+}
+
+bool isTimeMajorReady(void) {
+	pthread_mutex_lock(&timeMajorMutex);
+	bool ready = timeMajorReady;
+	pthread_mutex_unlock(&timeMajorMutex);
+	return ready;
+}
+
+// point is set to the grid point(row * numCols + col) closest to (x,y)
+bool findGridPoint(float x, float y, int &point) {
+	int index;
+	float w[4];
+	if (!findFirstCell(x, y, index)) return false;
+
+	// the corner with the largest weight is the closest
+	bilinearWeights(x, y, index, w);
+	int corners[4] = {index/2, index/2 + 1, index/2 + numCols + 1, index/2 + numCols};
+	int best = 0;
+	for (int k = 1; k < 4; k++) {
+		if (w[k] > w[best]) best = k;
+	}
+	point = corners[best];
+	return true;
+}
+
+// Copies the value of every attribute(SNOWPACK..RUNOFF) at a grid point for
+// every timestep into series[attr], which must each hold totalTimeSteps floats.
+// Returns false while the time-major layout is still being built.
+bool getPointTimeSeries(int point, float **series) {
+	int row = point / numCols, col = point % numCols;
+	return getAreaTimeSeries(row, row, col, col, series);
+}
+
+// Averages every attribute over the grid points in rows firstRow..lastRow and
+// columns firstCol..lastCol for every timestep, see getPointTimeSeries(). The
+// series come out of the time-major layout. In streaming mode the block is
+// read straight from the Ncfiles instead, and when the layout was skipped they
+// are gathered in a single pass over the timesteps.
+bool getAreaTimeSeries(int firstRow, int lastRow, int firstCol, int lastCol, float **series) {
+	firstRow = max(firstRow, 0);
+	firstCol = max(firstCol, 0);
+	lastRow = min(lastRow, numRows - 1);
+	lastCol = min(lastCol, numCols - 1);
+	int numPoints = (lastRow - firstRow + 1) * (lastCol - firstCol + 1);
+	if (lastRow < firstRow || lastCol < firstCol) numPoints = 0;
+
+	bool ready = isTimeMajorReady();
+	// the probe tries again once it's done
+	if (!ready && !streaming && timeMajorThreadStarted) return false;
+
+	for (int attr = 0; attr < 4; attr++) {
+		for (int timeStep = 0; timeStep < totalTimeSteps; timeStep++) series[attr][timeStep] = 0.0;
+	}
+	if (numPoints == 0) return true;
+
+	if (ready) {
+		// a tile at a time, so each tile's series are read in one pass
+		for (int tileRow = firstRow / TILE_SIZE; tileRow <= lastRow / TILE_SIZE; tileRow++) {
+			for (int tileCol = firstCol / TILE_SIZE; tileCol <= lastCol / TILE_SIZE; tileCol++) {
+				int rowEnd = min(lastRow, tileRow * TILE_SIZE + TILE_SIZE - 1);
+				int colEnd = min(lastCol, tileCol * TILE_SIZE + TILE_SIZE - 1);
+				for (int row = max(firstRow, tileRow * TILE_SIZE); row <= rowEnd; row++) {
+					for (int col = max(firstCol, tileCol * TILE_SIZE); col <= colEnd; col++) {
+						long offset = timeMajorOffset(row * numCols + col);
+						for (int attr = 0; attr < 4; attr++) {
+							addRecords(series[attr], timeMajorData[attr] + offset, totalTimeSteps);
+						}
+					}
+				}
+			}
+		}
+	}
+	else if (streaming) readAreaTimeSeries(firstRow, lastRow, firstCol, lastCol, series);
+	else {
+		// every attribute at once, so each timestep is only visited once
+		float *attrs[4] = {snowpackData, snowfallData, precipitationData, runoffData};
+		for (int timeStep = 0; timeStep < totalTimeSteps; timeStep++) {
+			long offset = (long)timeStep * recSize;
+			for (int attr = 0; attr < 4; attr++) {
+				for (int row = firstRow; row <= lastRow; row++) {
+					for (int col = firstCol; col <= lastCol; col++) {
+						series[attr][timeStep] += attrs[attr][offset + row * numCols + col];
+					}
+				}
+			}
+		}
+	}
+
+	for (int attr = 0; attr < 4; attr++) {
+		for (int timeStep = 0; timeStep < totalTimeSteps; timeStep++) series[attr][timeStep] /= numPoints;
+	}
+	return true;
+}
+
+// Streaming mode's getAreaTimeSeries(): sums the block out of each Ncfile with
+// one hyperslab read per variable, rather than reading whole records.
+void readAreaTimeSeries(int firstRow, int lastRow, int firstCol, int lastCol, float **series) {
+	int blockRows = lastRow - firstRow + 1, blockCols = lastCol - firstCol + 1;
+	long blockSize = (long)blockRows * blockCols;
+	long fileSize = timeSize * blockSize;
+	// the 4 attributes and the scratch for the combined fields
+	float *block = new float[5 * fileSize];
+	float *attrs[4] = {block, block + fileSize, block + 2 * fileSize, block + 3 * fileSize};
+
+	for (int fileNum = 0; fileNum < numNcFiles; fileNum++) {
+		pthread_mutex_lock(&ncMutex);
+		NcFile *ncF = new NcFile(ncFileNames[fileNum]);
+		pthread_mutex_unlock(&ncMutex);
+
+		bool success = ncF->is_valid() && readNcArea(ncF, fileNum, 0, timeSize,
+				firstRow, blockRows, firstCol, blockCols, attrs, block + 4 * fileSize);
+
+		pthread_mutex_lock(&ncMutex);
+		delete ncF;
+		pthread_mutex_unlock(&ncMutex);
+		// a file that can't be read stays at zero
+		if (!success) continue;
+
+		for (int attr = 0; attr < 4; attr++) {
+			float *dest = series[attr] + fileNum * timeSize;
+			for (long rec = 0; rec < timeSize; rec++) {
+				const float *values = attrs[attr] + rec * blockSize;
+				for (long i = 0; i < blockSize; i++) dest[rec] += values[i];
+			}
+		}
+	}
+
+	delete [] block;
+	return;
+}
+
+// Reduces size values into minVal/maxVal and, when prevValues isn't NULL,
+// values - prevValues into minDelta/maxDelta in the same pass.
+void reduceMinMax(const float *values, const float *prevValues, long size,
+		float &minVal, float &maxVal, float &minDelta, float &maxDelta) {
+	long i = 0;
+
+	#ifdef __SSE__
+	__m128 vMin = _mm_set1_ps(minVal), vMax = _mm_set1_ps(maxVal);
+	__m128 dMin = _mm_set1_ps(minDelta), dMax = _mm_set1_ps(maxDelta);
+	if (prevValues == NULL) {
+		for (; i + 4 <= size; i += 4) {
+			__m128 v = _mm_loadu_ps(values + i);
+			vMin = _mm_min_ps(vMin, v);
+			vMax = _mm_max_ps(vMax, v);
+		}
+	}
+	else {
+		for (; i + 4 <= size; i += 4) {
+			__m128 v = _mm_loadu_ps(values + i);
+			__m128 d = _mm_sub_ps(v, _mm_loadu_ps(prevValues + i));
+			vMin = _mm_min_ps(vMin, v);
+			vMax = _mm_max_ps(vMax, v);
+			dMin = _mm_min_ps(dMin, d);
+			dMax = _mm_max_ps(dMax, d);
+		}
+	}
+
+	// fold the 4 lanes back together
+	float lanes[4][4];
+	_mm_storeu_ps(lanes[0], vMin);
+	_mm_storeu_ps(lanes[1], vMax);
+	_mm_storeu_ps(lanes[2], dMin);
+	_mm_storeu_ps(lanes[3], dMax);
+	for (int lane = 0; lane < 4; lane++) {
+		if (lanes[0][lane] < minVal) minVal = lanes[0][lane];
+		if (lanes[1][lane] > maxVal) maxVal = lanes[1][lane];
+		if (lanes[2][lane] < minDelta) minDelta = lanes[2][lane];
+		if (lanes[3][lane] > maxDelta) maxDelta = lanes[3][lane];
+	}
+	#endif
+
+	// whatever is left over, or everything without SSE
+	for (; i < size; i++) {
+		float val = values[i];
+		if (val < minVal) minVal = val;
+		if (val > maxVal) maxVal = val;
+		if (prevValues == NULL) continue;
+
+		float delta = val - prevValues[i];
+		if (delta < minDelta) minDelta = delta;
+		if (delta > maxDelta) maxDelta = delta;
+	}
+	return;
+}
+
+// Reduces numSteps timesteps of all 4 attributes, and the daily deltas between
+// them, into mins/maxs (indexed like weatherAttrMin). prevAttrs is the timestep
+// just before attrs; when it's NULL the delta into the first timestep is left
+// to the caller.
+void reduceMaxsAndMins(float **attrs, float **prevAttrs, long numSteps, float *mins, float *maxs) {
+	for (int attr = 0; attr < 4; attr++) {
+		const float *prevValues = (prevAttrs != NULL) ? prevAttrs[attr] : NULL;
+		// the first timestep against the one before it
+		reduceMinMax(attrs[attr], prevValues, recSize,
+				mins[attr], maxs[attr], mins[attr + 4], maxs[attr + 4]);
+		// every other timestep against its predecessor in the same buffer
+		reduceMinMax(attrs[attr] + recSize, attrs[attr], (numSteps - 1) * recSize,
+				mins[attr], maxs[attr], mins[attr + 4], maxs[attr + 4]);
+	}
+	return;
+}
+
+// Every file is reduced into its own 8 mins/maxs so the workers never share
+// them. The run starts with a daily delta of 0, so file 0 starts its deltas there.
+// They're shared with the ingest workers.
+void allocateFileMaxsAndMins(float **mins, float **maxs) {
+	float *shared = (float *)sharedAlloc(2 * 8 * numNcFiles * sizeof(float));
+	*mins = shared;
+	*maxs = shared + 8 * numNcFiles;
+	for (int fileNum = 0; fileNum < numNcFiles; fileNum++) {
+		excludeFileMaxsAndMins(*mins, *maxs, fileNum);
+	}
+	for (int attr = 4; attr <= RUNOFF_DAILY; attr++) {
+		(*mins)[attr] = 0.0;
+		(*maxs)[attr] = 0.0;
+	}
+	return;
+}
+
+// resets a file's mins/maxs so it doesn't count in mergeMaxsAndMins()
+void excludeFileMaxsAndMins(float *mins, float *maxs, int fileNum) {
+	for (int attr = 0; attr <= RUNOFF_DAILY; attr++) {
+		mins[8 * fileNum + attr] = MAX_FLOAT;
+		maxs[8 * fileNum + attr] = -MAX_FLOAT;
+	}
+	return;
+}
+
+void freeFileMaxsAndMins(float *mins, float *maxs) {
+	munmap(mins, 2 * 8 * numNcFiles * sizeof(float));
+	return;
+}
+
+// folds count sets of per-file mins/maxs into weatherAttrMin/weatherAttrMax
+void mergeMaxsAndMins(float *mins, float *maxs, int count) {
+	for (int i = 0; i < count; i++) {
+		for (int attr = 0; attr <= RUNOFF_DAILY; attr++) {
+			if (mins[i * 8 + attr] < weatherAttrMin[attr]) weatherAttrMin[attr] = mins[i * 8 + attr];
+			if (maxs[i * 8 + attr] > weatherAttrMax[attr]) weatherAttrMax[attr] = maxs[i * 8 + attr];
+		}
+	}
+
+	#ifdef DEBUG2
+	// print out mins/maxs
+	cout << "snowpackMin = " << weatherAttrMin[SNOWPACK] << endl;
+	cout << "snowpackMax = " << weatherAttrMax[SNOWPACK] << endl;
+	cout << "snowfallMin = " << weatherAttrMin[SNOWFALL] << endl;
+	cout << "snowfallMax = " << weatherAttrMax[SNOWFALL] << endl;
+	cout << "precipitationMin = " << weatherAttrMin[PRECIPITATION] << endl;
+	cout << "precipitationMax = " << weatherAttrMax[PRECIPITATION] << endl;
+	cout << "runoffMin = " << weatherAttrMin[RUNOFF] << endl;
+	cout << "runoffMax = " << weatherAttrMax[RUNOFF] << endl;
+	cout << "snowpackDailyMin = " << weatherAttrMin[4] << endl;
+	cout << "snowpackDailyMax = " << weatherAttrMax[4] << endl;
+	cout << "snowfallDailyMin = " << weatherAttrMin[5] << endl;
+	cout << "snowfallDailyMax = " << weatherAttrMax[5] << endl;
+	cout << "precipitationDailyMin = " << weatherAttrMin[6] << endl;
+	cout << "precipitationDailyMax = " << weatherAttrMax[6] << endl;
+	cout << "runoffDailyMin = " << weatherAttrMin[7] << endl;
+	cout << "runoffDailyMax = " << weatherAttrMax[7] << endl;
+	#endif
+	return;
+}
+
+// Streaming mode's ingestNcFile(): reads one file, and the last timestep of
+// the file before it for the daily deltas, into buffer just long enough to
+// find the maxs and mins. buffer holds 4 * (timeSize + 1) * recSize floats
+// for the data plus timeSize * recSize for the combined fields.
+bool scanNcFile(int fileNum, char **fileList, float *fileMins, float *fileMaxs, float *buffer) {
+	float *prevAttrs[4], *attrs[4];
+	for (int attr = 0; attr < 4; attr++) {
+		prevAttrs[attr] = buffer + attr * (timeSize + 1) * recSize;
+		attrs[attr] = prevAttrs[attr] + recSize;
+	}
+	float *scratch = buffer + 4 * (timeSize + 1) * recSize;
+
+	#ifdef CONSOLE_OUTPUT
+	printf("Scanning Ncfile[%d]\n", fileNum);
+	#endif
+	pthread_mutex_lock(&ncMutex);
+	NcFile *ncF = new NcFile(fileList[fileNum]);
+	NcFile *prevNcF = (fileNum > 0) ? new NcFile(fileList[fileNum - 1]) : NULL;
+	pthread_mutex_unlock(&ncMutex);
+
+	bool success = ncF->is_valid() && readNcRecords(ncF, fileNum, 0, timeSize,
+			attrs[0], attrs[1], attrs[2], attrs[3], scratch);
+	// the daily deltas at the start of this file need the last timestep of the previous one
+	bool havePrev = prevNcF != NULL && prevNcF->is_valid() &&
+			readNcRecords(prevNcF, fileNum - 1, timeSize - 1, 1,
+					prevAttrs[0], prevAttrs[1], prevAttrs[2], prevAttrs[3], scratch);
+
+	if (success) {
+		reduceMaxsAndMins(attrs, havePrev ? prevAttrs : NULL, timeSize,
+				fileMins + 8 * fileNum, fileMaxs + 8 * fileNum);
+	}
+	#ifndef ERROR_NOTIFICATION_OFF
+	else printf("Error: Couldn't read %s.\n", fileList[fileNum]);
+	#endif
+
+	pthread_mutex_lock(&ncMutex);
+	delete ncF;
+	delete prevNcF;
+	pthread_mutex_unlock(&ncMutex);
+	return success;
+}
+
+// Streaming mode can't keep the run resident, so the workers only find the
+// maxs and mins of each file.
+void getNcFileStreamData(char **fileList) {
+	float *fileMins, *fileMaxs;
+	allocateFileMaxsAndMins(&fileMins, &fileMaxs);
+
+	vector<char> failed;
+	runIngestWorkers(scanNcFile, (5 * timeSize + 4) * recSize, fileList, fileMins, fileMaxs, failed);
+	for (int fileNum = 0; fileNum < numNcFiles; fileNum++) {
+		if (failed[fileNum]) excludeFileMaxsAndMins(fileMins, fileMaxs, fileNum);
+	}
+
+	mergeMaxsAndMins(fileMins, fileMaxs, numNcFiles);
+	freeFileMaxsAndMins(fileMins, fileMaxs);
+	return;
+}
+
+// Gets the data for one shape file, from its sidecar cache if that's still
+// current. Otherwise libshp reads it into flat arrays and the cache is rewritten.
+int getShapeFileData(int fileNum, char *fileName) {
+	int nEntities, shapeType, totalParts = 0, totalPoints = 0;
+	double minCoords[4], maxCoords[4];
+
+	// initialize the entries for this file
+	shapedata_t empty;
+	memset(&empty, 0, sizeof(empty));
+	shapeFiles.push_back(empty);
+	shapeFileNames.push_back(fileName);
+	shapeBatches.push_back(shapebatch_t());
+	shapeBatches[fileNum].buffer = 0;
+
+	if (loadShapeCache(fileNum, fileName)) {
+		buildShapeBatch(fileNum);
+		return 0;
+	}
+
+	// get a handle for the shapefile
+	SHPHandle hSHP = SHPOpen(fileName, "rb");
+	// return error if file is not valid
+	if (hSHP == NULL) {
+		//fprintf(stderr, "Error: %s is not a shapefile. Skipping\n", fileName);
+		shapeFiles.pop_back();
+		shapeFileNames.pop_back();
+		shapeBatches.pop_back();
+		return -1;
+	}
+	SHPGetInfo(hSHP, &nEntities, &shapeType, minCoords, maxCoords);
+	
+	// good debug info
+	#ifdef CONSOLE_OUTPUT
+	printf("Processing shapefile[%d] %s\n", fileNum, fileName);
+	#endif
+
+	// every vertex takes 16 bytes of the .shp, so its size bounds the number of points
+	// and the vertices can go straight into the final array
+	long long shpSize, shpTime;
+	if (!shapeFileStat(fileName, shpSize, shpTime)) shpSize = 0;
+	long maxPoints = (long)(shpSize / 16);
+
+	shapedata_t &shapes = shapeFiles[fileNum];
+	shapes.entityStart = new int[nEntities + 1];
+	shapes.coords = new float[2 * maxPoints];
+	// the parts are only known once they've all been read
+	vector<int> partStart;
+	partStart.reserve(nEntities + 1);
+	bool overflow = false;
+
+	// go though all the entities
+	for (int currEntity = 0; currEntity < nEntities; currEntity++) {
+		shapes.entityStart[currEntity] = partStart.size();
+
+		// get a reference to the current object
+		SHPObject *sObj = SHPReadObject(hSHP, currEntity);
+		if (totalPoints + (long)sObj->nVertices > maxPoints) {
+			SHPDestroyObject(sObj);
+			overflow = true;
+			break;
+		}
+		
+		#ifdef DEBUG2
+		printf("type = %d id = %d, parts = %d nVertices = %d\n",
+			   	sObj->nSHPType, sObj->nShapeId, sObj->nParts, sObj->nVertices);
+		#endif
+
+		// get the offsets for each part separately, counted from the first vertex of the file
+		for (int currPart = 0; currPart < sObj->nParts; currPart++) {
+			partStart.push_back(totalPoints + sObj->panPartStart[currPart]);
+			#ifdef DEBUG2
+			printf("Processing entity %d, part %d ", currEntity, currPart);
+			printf("panPartStart[%d] = %d\n", currPart, sObj->panPartStart[currPart]);
+			#endif
+		}
+
+		// get the vertex data for the entire entity
+		for (int currVertex = 0; currVertex < sObj->nVertices; currVertex++) {
+			// interleave (x,y) coords; this actually makes it easier to render
+			shapes.coords[2 * (totalPoints + currVertex)] = sObj->padfX[currVertex];
+			shapes.coords[2 * (totalPoints + currVertex) + 1] = sObj->padfY[currVertex];
+
+			#ifdef DEBUG2
+			printf("\tx[%d] = %f, y[%d] = %f\n",
+				   	currVertex, sObj->padfX[currVertex], currVertex, sObj->padfY[currVertex]);
+			#endif
+		}
+		totalPoints += sObj->nVertices;
+		totalParts += sObj->nParts;
+		
+		SHPDestroyObject(sObj);
+	}
+	SHPClose(hSHP);
+
+	// the file holds more vertices than it has room for, so it's corrupt
+	if (overflow) {
+		#ifndef ERROR_NOTIFICATION_OFF
+		fprintf(stderr, "Error: Shapefile %s is corrupt. Skipping\n", fileName);
+		#endif
+		delete [] shapes.entityStart;
+		delete [] shapes.coords;
+		shapeFiles.pop_back();
+		shapeFileNames.pop_back();
+		shapeBatches.pop_back();
+		return -1;
+	}
+
+	// make sure to get the last index so we know where to stop for the final entity and part
+	shapes.entityStart[nEntities] = partStart.size();
+	partStart.push_back(totalPoints);
+	
+	#ifdef DEBUG2
+	printf("File %d has %d entities, %d total parts and %d total points\n",
+		   	fileNum, nEntities, totalParts, totalPoints);
+	#endif
+
+	shapes.numEntities = nEntities;
+	shapes.numParts = totalParts;
+	shapes.numPoints = totalPoints;
+	shapes.partStart = new int[totalParts + 1];
+	copy(partStart.begin(), partStart.end(), shapes.partStart);
+
+	writeShapeCache(fileNum, fileName);
+
+	buildShapeBatch(fileNum);
+	return 0;
+}
+
+// the sidecar cache of a shapefile, next to it with .shp replaced
+string shapeCachePath(char *fileName) {
+	string path(fileName);
+	if (path.size() > 4 && strcasecmp(path.c_str() + path.size() - 4, ".shp") == 0) {
+		path.erase(path.size() - 4);
+	}
+	return path + SHAPE_CACHE_EXTENSION;
+}
+
+// size and mtime of the .shp behind fileName, which libshp accepts with or without the extension
+bool shapeFileStat(char *fileName, long long &size, long long &mtime) {
+	struct stat st;
+	if (stat(fileName, &st) != 0 && stat((string(fileName) + ".shp").c_str(), &st) != 0) {
+		return false;
+	}
+	size = (long long)st.st_size;
+	mtime = (long long)st.st_mtime;
+	return true;
+}
+
+// Maps the sidecar cache of a shapefile straight into shapeFiles[fileNum].
+// Returns false if there is no cache or the shapefile changed since it was written.
+bool loadShapeCache(int fileNum, char *fileName) {
+	long long shpSize, shpTime;
+	if (!shapeFileStat(fileName, shpSize, shpTime)) return false;
+
+	string path = shapeCachePath(fileName);
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	shapecacheheader_t header;
+	if (fstat(fd, &st) != 0 || st.st_size < sizeof(header) ||
+			read(fd, &header, sizeof(header)) != sizeof(header)) {
+		close(fd);
+		return false;
+	}
+
+	long expectedSize = sizeof(header) + (header.numEntities + 1 + header.numParts + 1) * sizeof(int)
+			+ 2 * (long)header.numPoints * sizeof(float);
+	if (memcmp(header.magic, SHAPE_CACHE_MAGIC, sizeof(header.magic)) != 0 ||
+			header.version != SHAPE_CACHE_VERSION ||
+			header.shpSize != shpSize || header.shpTime != shpTime ||
+			header.numEntities < 0 || header.numParts < 0 || header.numPoints < 0 ||
+			st.st_size != expectedSize) {
+		#ifdef CONSOLE_OUTPUT
+		printf("Shapefile cache %s is out of date. Rebuilding it.\n", path.c_str());
+		#endif
+		close(fd);
+		return false;
+	}
+
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return false;
+
+	shapedata_t &shapes = shapeFiles[fileNum];
+	shapes.numEntities = header.numEntities;
+	shapes.numParts = header.numParts;
+	shapes.numPoints = header.numPoints;
+	shapes.entityStart = (int *)((char *)map + sizeof(header));
+	shapes.partStart = shapes.entityStart + header.numEntities + 1;
+	shapes.coords = (float *)(shapes.partStart + header.numParts + 1);
+	shapes.map = map;
+	shapes.mapSize = st.st_size;
+
+	// the offsets index straight into the arrays, so make sure they stay inside them
+	bool valid = shapes.entityStart[0] >= 0 && shapes.entityStart[shapes.numEntities] <= shapes.numParts &&
+			shapes.partStart[0] >= 0 && shapes.partStart[shapes.numParts] <= shapes.numPoints;
+	for (int entity = 0; valid && entity < shapes.numEntities; entity++) {
+		valid = shapes.entityStart[entity] <= shapes.entityStart[entity + 1];
+	}
+	for (int part = 0; valid && part < shapes.numParts; part++) {
+		valid = shapes.partStart[part] <= shapes.partStart[part + 1];
+	}
+	if (!valid) {
+		#ifdef CONSOLE_OUTPUT
+		printf("Shapefile cache %s is corrupt. Rebuilding it.\n", path.c_str());
+		#endif
+		munmap(map, st.st_size);
+		memset(&shapes, 0, sizeof(shapes));
+		return false;
+	}
+
+	#ifdef CONSOLE_OUTPUT
+	printf("Loaded shapefile[%d] %s from cache %s\n", fileNum, fileName, path.c_str());
+	#endif
+	return true;
+}
+
+// Writes the flattened shapefile next to it. Like the weather cache it's
+// written under a temporary name and renamed into place.
+void writeShapeCache(int fileNum, char *fileName) {
+	const shapedata_t &shapes = shapeFiles[fileNum];
+
+	shapecacheheader_t header;
+	memset(&header, 0, sizeof(header));
+	if (!shapeFileStat(fileName, header.shpSize, header.shpTime)) return;
+	memcpy(header.magic, SHAPE_CACHE_MAGIC, sizeof(header.magic));
+	header.version = SHAPE_CACHE_VERSION;
+	header.numEntities = shapes.numEntities;
+	header.numParts = shapes.numParts;
+	header.numPoints = shapes.numPoints;
+
+	string path = shapeCachePath(fileName);
+	string tmpPath = path + ".tmp";
+	FILE *fout = fopen(tmpPath.c_str(), "wb");
+	// a read only directory just means no cache
+	if (fout == NULL) return;
+
+	bool success = fwrite(&header, sizeof(header), 1, fout) == 1;
+	success &= fwrite(shapes.entityStart, sizeof(int), shapes.numEntities + 1, fout) ==
+			shapes.numEntities + 1;
+	success &= fwrite(shapes.partStart, sizeof(int), shapes.numParts + 1, fout) == shapes.numParts + 1;
+	success &= fwrite(shapes.coords, sizeof(float), 2 * shapes.numPoints, fout) ==
+			2 * shapes.numPoints;
+	success &= fclose(fout) == 0;
+
+	if (!success || rename(tmpPath.c_str(), path.c_str()) != 0) {
+		#ifndef ERROR_NOTIFICATION_OFF
+		fprintf(stderr, "Error: Couldn't write shapefile cache %s.\n", path.c_str());
+		#endif
+		unlink(tmpPath.c_str());
+	}
+	return;
+}
+
+void jpegErrorExit(j_common_ptr cinfo) {
+	#ifndef ERROR_NOTIFICATION_OFF
+	(*cinfo->err->output_message)(cinfo);
+	#endif
+	longjmp(((jpegerror_t *)cinfo->err)->jump, 1);
+}
+
+// Decodes one JPEG into new[]'d RGB pixels, bottom row first. Only touches
+// its own libjpeg state, so any number of threads can run it at once.
+bool decodeJPEG(char *imageName, unsigned char *&pixels, int &width, int &height) {
+	pixels = NULL;
+	FILE *fin = fopen(imageName, "rb");
+	if (fin == NULL) {
+		#ifndef ERROR_NOTIFICATION_OFF
+		fprintf(stderr, "Error: Couldn't open image \"%s\".\n", imageName);
+		#endif
+		return false;
+	}
+
+	struct jpeg_decompress_struct cinfo;
+	jpegerror_t jerr;
+	cinfo.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = jpegErrorExit;
+	if (setjmp(jerr.jump)) {
+		#ifndef ERROR_NOTIFICATION_OFF
+		fprintf(stderr, "Error decoding image \"%s\".\n", imageName);
+		#endif
+		jpeg_destroy_decompress(&cinfo);
+		fclose(fin);
+		delete [] pixels;
+		pixels = NULL;
+		return false;
+	}
+
+	jpeg_create_decompress(&cinfo);
+	jpeg_stdio_src(&cinfo, fin);
+	jpeg_read_header(&cinfo, TRUE);
+	// grayscale and CMYK images come out as RGB too
+	cinfo.out_color_space = JCS_RGB;
+	jpeg_start_decompress(&cinfo);
+
+	width = cinfo.output_width;
+	height = cinfo.output_height;
+	long rowSize = 3L * width;
+	pixels = new unsigned char[rowSize * height];
+	while (cinfo.output_scanline < cinfo.output_height) {
+		// the file is top row first
+		JSAMPROW row = pixels + (height - 1 - cinfo.output_scanline) * rowSize;
+		jpeg_read_scanlines(&cinfo, &row, 1);
+	}
+
+	jpeg_finish_decompress(&cinfo);
+	jpeg_destroy_decompress(&cinfo);
+	fclose(fin);
+	return true;
+}
+
+// Writes the width x height block at (x0,y0) of a bottom row first RGB
+// image as a JPEG, top row first like decodeJPEG() expects.
+bool writeTileJPEG(const char *fileName, const unsigned char *pixels, int rowPixels,
+		int x0, int y0, int width, int height) {
+	FILE *fout = fopen(fileName, "wb");
+	if (fout == NULL) return false;
+
+	struct jpeg_compress_struct cinfo;
+	jpegerror_t jerr;
+	cinfo.err = jpeg_std_error(&jerr.pub);
+	jerr.pub.error_exit = jpegErrorExit;
+	if (setjmp(jerr.jump)) {
+		jpeg_destroy_compress(&cinfo);
+		fclose(fout);
+		unlink(fileName);
+		return false;
+	}
+
+	jpeg_create_compress(&cinfo);
+	jpeg_stdio_dest(&cinfo, fout);
+	cinfo.image_width = width;
+	cinfo.image_height = height;
+	cinfo.input_components = 3;
+	cinfo.in_color_space = JCS_RGB;
+	jpeg_set_defaults(&cinfo);
+	jpeg_set_quality(&cinfo, 90, TRUE);
+	jpeg_start_compress(&cinfo, TRUE);
+	while (cinfo.next_scanline < cinfo.image_height) {
+		int y = y0 + height - 1 - cinfo.next_scanline;
+		JSAMPROW row = (JSAMPROW)(pixels + 3L * ((long)y * rowPixels + x0));
+		jpeg_write_scanlines(&cinfo, &row, 1);
+	}
+	jpeg_finish_compress(&cinfo);
+	jpeg_destroy_compress(&cinfo);
+	return fclose(fout) == 0;
+}
+
+// tiles are numbered from the bottom left of their level
+string tilePath(const mapimage_t &image, int level, int row, int col) {
+	char name[64];
+	snprintf(name, sizeof(name), "/L%d_R%d_C%d.jpg", level, row, col);
+	return image.pyramidDir + name;
+}
+
+// Where the pyramid of an image in a read only directory goes: $TMPDIR(or
+// /tmp)/ingest-pyramids/ with the image's full path flattened into the name,
+// so images with the same name in different directories don't collide.
+string fallbackPyramidDir(const char *fileName) {
+	const char *tmpDir = getenv("TMPDIR");
+	string dir = (tmpDir != NULL && tmpDir[0] != '\0') ? tmpDir : "/tmp";
+	dir += "/ingest-pyramids";
+	mkdir(dir.c_str(), 0755);
+
+	char *fullPath = realpath(fileName, NULL);
+	string name = (fullPath != NULL) ? fullPath : fileName;
+	free(fullPath);
+	for (int i = 0; i < name.size(); i++) {
+		if (name[i] == '/') name[i] = '_';
+	}
+	if (name.size() > 4 && strcasecmp(name.c_str() + name.size() - 4, ".jpg") == 0) {
+		name.erase(name.size() - 4);
+	}
+	return dir + "/" + name + ".pyramid";
+}
+
+// Fills in the image's size from the index in dir if it's there and was
+// written for the source as it is now(st).
+bool readPyramidIndex(mapimage_t &image, const string &dir, const struct stat &st) {
+	FILE *fin = fopen((dir + "/index.txt").c_str(), "r");
+	if (fin == NULL) return false;
+
+	int width, height, numLevels, tilePixels;
+	long long srcSize, srcTime;
+	bool current = fscanf(fin, "%d %d %d %d %lld %lld", &width, &height, &numLevels,
+			&tilePixels, &srcSize, &srcTime) == 6 && tilePixels == TILE_PIXELS &&
+			srcSize == (long long)st.st_size && srcTime == (long long)st.st_mtime;
+	fclose(fin);
+	if (current) {
+		image.width = width;
+		image.height = height;
+		image.numLevels = numLevels;
+	}
+	return current;
+}
+
+// Makes sure the image's pyramid is on disk next to it, in <name>.pyramid/, or
+// in fallbackPyramidDir() if that can't be written, and fills in its size. The
+// index is written last and records the size and mtime of the source, so an
+// interrupted build or a changed image is redone.
+bool buildImagePyramid(int imageNum) {
+	mapimage_t &image = mapImages[imageNum];
+
+	struct stat st;
+	if (stat(image.fileName, &st) != 0) {
+		#ifndef ERROR_NOTIFICATION_OFF
+		fprintf(stderr, "Error: Couldn't open image \"%s\".\n", image.fileName);
+		#endif
+		return false;
+	}
+
+	if (readPyramidIndex(image, image.pyramidDir, st)) return true;
+	string fallbackDir = fallbackPyramidDir(image.fileName);
+	if (readPyramidIndex(image, fallbackDir, st)) {
+		image.pyramidDir = fallbackDir;
+		return true;
+	}
+
+	// shared basemaps are often read only, build those where we can write
+	mkdir(image.pyramidDir.c_str(), 0755);
+	if (access(image.pyramidDir.c_str(), W_OK) != 0) {
+		image.pyramidDir = fallbackDir;
+		mkdir(image.pyramidDir.c_str(), 0755);
+	}
+	string indexPath = image.pyramidDir + "/index.txt";
+
+	#ifdef CONSOLE_OUTPUT
+	printf("Building the tile pyramid of %s in %s\n", image.fileName, image.pyramidDir.c_str());
+	#endif
+
+	unsigned char *pixels;
+	int width, height;
+	if (!decodeJPEG(image.fileName, pixels, width, height)) return false;
+
+	bool success = true;
+	int level = 0;
+	int levelWidth = width, levelHeight = height;
+	while (success) {
+		for (int y0 = 0; y0 < levelHeight && success; y0 += TILE_PIXELS) {
+			for (int x0 = 0; x0 < levelWidth && success; x0 += TILE_PIXELS) {
+				string path = tilePath(image, level, y0 / TILE_PIXELS, x0 / TILE_PIXELS);
+				success = writeTileJPEG(path.c_str(), pixels, levelWidth, x0, y0,
+						min(TILE_PIXELS, levelWidth - x0), min(TILE_PIXELS, levelHeight - y0));
+			}
+		}
+		if (levelWidth <= TILE_PIXELS && levelHeight <= TILE_PIXELS) break;
+
+		// 2x2 box filter down to the next level, the last row/column is repeated on odd sizes
+		int nextWidth = (levelWidth + 1) / 2, nextHeight = (levelHeight + 1) / 2;
+		unsigned char *next = new unsigned char[3L * nextWidth * nextHeight];
+		for (int y = 0; y < nextHeight; y++) {
+			int y0 = 2 * y, y1 = min(2 * y + 1, levelHeight - 1);
+			for (int x = 0; x < nextWidth; x++) {
+				int x0 = 2 * x, x1 = min(2 * x + 1, levelWidth - 1);
+				for (int c = 0; c < 3; c++) {
+					int sum = pixels[3L * ((long)y0 * levelWidth + x0) + c] +
+							pixels[3L * ((long)y0 * levelWidth + x1) + c] +
+							pixels[3L * ((long)y1 * levelWidth + x0) + c] +
+							pixels[3L * ((long)y1 * levelWidth + x1) + c];
+					next[3L * ((long)y * nextWidth + x) + c] = (sum + 2) / 4;
+				}
+			}
+		}
+		delete [] pixels;
+		pixels = next;
+		levelWidth = nextWidth;
+		levelHeight = nextHeight;
+		level++;
+	}
+	delete [] pixels;
+
+	FILE *fout = success ? fopen(indexPath.c_str(), "w") : NULL;
+	if (fout == NULL) {
+		#ifndef ERROR_NOTIFICATION_OFF
+		fprintf(stderr, "Error: Couldn't write the tile pyramid %s.\n", image.pyramidDir.c_str());
+		#endif
+		return false;
+	}
+	fprintf(fout, "%d %d %d %d %lld %lld\n", width, height, level + 1, TILE_PIXELS,
+			(long long)st.st_size, (long long)st.st_mtime);
+	fclose(fout);
+
+	image.width = width;
+	image.height = height;
+	image.numLevels = level + 1;
+	return true;
+}
+
+// worker of the tile loader pool
+void *tileLoader(void *arg) {
+	pthread_mutex_lock(&tileMutex);
+	while (true) {
+		while (!tileLoaderStop && pyramidNext >= mapImages.size() && tileRequests.empty()) {
+			pthread_cond_wait(&tileCond, &tileMutex);
+		}
+		if (tileLoaderStop) break;
+
+		// every pyramid comes before any tile
+		if (pyramidNext < mapImages.size()) {
+			int imageNum = pyramidNext++;
+			pthread_mutex_unlock(&tileMutex);
+			bool ready = buildImagePyramid(imageNum);
+			pthread_mutex_lock(&tileMutex);
+			mapImages[imageNum].ready = ready;
+			pyramidsDone++;
+			continue;
+		}
+
+		tiledecode_t tile;
+		tile.key = tileRequests.front();
+		tileRequests.pop_front();
+		tilesLoading.insert(tile.key);
+		pthread_mutex_unlock(&tileMutex);
+
+		string path = tilePath(mapImages[tile.key.image], tile.key.level, tile.key.row, tile.key.col);
+		decodeJPEG((char *)path.c_str(), tile.pixels, tile.width, tile.height);
+
+		pthread_mutex_lock(&tileMutex);
+		tilesDecoded.push_back(tile);
+	}
+	pthread_mutex_unlock(&tileMutex);
+	return NULL;
+}
+
+// starts the tile loaders, one per core(or -j)
+void startTileLoaders(void) {
+	int numThreads = (numIngestThreads > 0) ? numIngestThreads : sysconf(_SC_NPROCESSORS_ONLN);
+	numThreads = max(numThreads, 1);
+	for (int i = 0; i < numThreads; i++) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, tileLoader, NULL) == 0) {
+			tileLoaderThreads.push_back(thread);
+		}
+	}
+
+	#ifndef ERROR_NOTIFICATION_OFF
+	if (tileLoaderThreads.empty()) {
+		fprintf(stderr, "Error: Couldn't start the tile loaders. The maps won't be drawn.\n");
+	}
+	#endif
+	return;
+}
+
+// Replaces the queue of tiles to load with the ones the current view is
+// missing, so tiles that scrolled out of view are never loaded.
+void requestTiles(const vector<tilekey_t> &wanted) {
+	pthread_mutex_lock(&tileMutex);
+	tileRequests.clear();
+	for (int i = 0; i < wanted.size(); i++) {
+		if (tilesLoading.count(wanted[i]) == 0 && tilesFailed.count(wanted[i]) == 0) {
+			tileRequests.push_back(wanted[i]);
+		}
+	}
+	if (!tileRequests.empty()) pthread_cond_broadcast(&tileCond);
+	pthread_mutex_unlock(&tileMutex);
+	return;
+}
+
+// Uploads up to TEXTURE_UPLOADS_PER_FRAME of the decoded tiles, needs a
+// current GL context. Returns how many it uploaded.
+int uploadDecodedTiles(void) {
+	int upload;
+	for (upload = 0; upload < TEXTURE_UPLOADS_PER_FRAME; upload++) {
+		pthread_mutex_lock(&tileMutex);
+		if (tilesDecoded.empty()) {
+			pthread_mutex_unlock(&tileMutex);
+			break;
+		}
+		tiledecode_t tile = tilesDecoded.back();
+		tilesDecoded.pop_back();
+		pthread_mutex_unlock(&tileMutex);
+
+		if (tile.pixels != NULL) {
+			residenttile_t resident;
+			glGenTextures(1, &resident.texture);
+			glBindTexture(GL_TEXTURE_2D, resident.texture);
+
+			// mipmaps for the zooms between pyramid levels
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+			glTexParameteri(GL_TEXTURE_2D, GL_GENERATE_MIPMAP, GL_TRUE);
+
+			// RGB rows aren't padded to 4 bytes
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, tile.width, tile.height, 0, GL_RGB,
+					GL_UNSIGNED_BYTE, tile.pixels);
+			glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+			delete [] tile.pixels;
+
+			// the mipmaps add a third
+			resident.bytes = 4L * tile.width * tile.height * 4 / 3;
+			resident.lastUsed = tileFrame;
+			residentTiles[tile.key] = resident;
+			residentTileBytes += resident.bytes;
+		}
+
+		// only now, or redraw could ask for it again in between
+		pthread_mutex_lock(&tileMutex);
+		tilesLoading.erase(tile.key);
+		if (tile.pixels == NULL) tilesFailed.insert(tile.key);
+		pthread_mutex_unlock(&tileMutex);
+	}
+	evictTiles();
+	return upload;
+}
+
+// true while pyramids are being built or tiles the last frame asked for are still loading
+bool tilesPending(void) {
+	// nothing will ever load without the loaders
+	if (tileLoaderThreads.empty()) return false;
+	pthread_mutex_lock(&tileMutex);
+	bool pending = pyramidsDone < mapImages.size() || !tileRequests.empty() ||
+			!tilesLoading.empty() || !tilesDecoded.empty();
+	pthread_mutex_unlock(&tileMutex);
+	return pending;
+}
+
+// lets go of the least recently drawn tiles until they fit the budget again,
+// never the ones drawn this frame
+void evictTiles(void) {
+	while (residentTileBytes > TILE_TEXTURE_BUDGET) {
+		map<tilekey_t, residenttile_t>::iterator oldest = residentTiles.end();
+		map<tilekey_t, residenttile_t>::iterator it;
+		for (it = residentTiles.begin(); it != residentTiles.end(); it++) {
+			if (it->second.lastUsed >= tileFrame) continue;
+			if (oldest == residentTiles.end() || it->second.lastUsed < oldest->second.lastUsed) {
+				oldest = it;
+			}
+		}
+		if (oldest == residentTiles.end()) break;
+
+		glDeleteTextures(1, &oldest->second.texture);
+		residentTileBytes -= oldest->second.bytes;
+		residentTiles.erase(oldest);
+	}
+	return;
+}
+
+// the coarsest level with at least one texel per screen pixel at the current zoom
+int tileLevel(const mapimage_t &image, float imageWidth) {
+	// world units covered by one pixel at the current zoom
+	double pixelSize = 2.0 * eye[2] * tan(FOVY * M_PI / 360.0) / screenHeight;
+	double texelSize = imageWidth / image.width;
+	int level = 0;
+	while (level + 1 < image.numLevels && 2.0 * texelSize <= pixelSize) {
+		texelSize *= 2.0;
+		level++;
+	}
+	return level;
+}
+
+// draws a tile if it's resident, returns false if it still has to be loaded
+bool drawTile(const tilekey_t &key, float x0, float y0, float x1, float y1) {
+	map<tilekey_t, residenttile_t>::iterator it = residentTiles.find(key);
+	if (it == residentTiles.end()) return false;
+	it->second.lastUsed = tileFrame;
+
+	glBindTexture(GL_TEXTURE_2D, it->second.texture);
+	glBegin(GL_QUADS);
+		glTexCoord2i(0, 0); glVertex3f(x0, y0, 0.0);
+		glTexCoord2i(0, 1); glVertex3f(x0, y1, 0.0);
+		glTexCoord2i(1, 1); glVertex3f(x1, y1, 0.0);
+		glTexCoord2i(1, 0); glVertex3f(x1, y0, 0.0);
+	glEnd();
+	return true;
+}
+
+// Draws the tiles of every image that are in view, at the level matching the
+// zoom. The top level of each image is drawn underneath, so there's
+// something to see while the finer tiles load. Missing tiles are requested.
+void drawMapTiles(void) {
+	// scaling factors
+	float sizex = 40.0;
+	float sizey = 50.0;
+
+	#ifdef CORRECT_TEX_LOC
+	float correctionX = 0.03;
+	float correctionY = 0.045;
+	#else
+	float correctionX = 0.0;
+	float correctionY = 0.0;
+	#endif
+
+	// the camera looks straight down at eye
+	float halfHeight = eye[2] * tan(FOVY * M_PI / 360.0);
+	float halfWidth = halfHeight * screenWidth / screenHeight;
+	float viewXMin = eye[0] - halfWidth, viewXMax = eye[0] + halfWidth;
+	float viewYMin = eye[1] - halfHeight, viewYMax = eye[1] + halfHeight;
+
+	tileFrame++;
+	vector<tilekey_t> wanted;
+	glEnable(GL_TEXTURE_2D);
+
+	for (int i = 0; i < mapImages.size(); i++) {
+		pthread_mutex_lock(&tileMutex);
+		bool ready = mapImages[i].ready;
+		pthread_mutex_unlock(&tileMutex);
+		if (!ready) continue;
+		const mapimage_t &image = mapImages[i];
+
+		float lowerx = texCoords[i].x - correctionX;
+		float lowery = texCoords[i].y - correctionY;
+		if (lowerx > viewXMax || lowerx + sizex < viewXMin ||
+				lowery > viewYMax || lowery + sizey < viewYMin) continue;
+
+		tilekey_t key = {i, image.numLevels - 1, 0, 0};
+		if (!drawTile(key, lowerx, lowery, lowerx + sizex, lowery + sizey)) wanted.push_back(key);
+
+		int level = tileLevel(image, sizex);
+		if (level == image.numLevels - 1) continue;
+
+		// world size of a whole tile at this level
+		int levelWidth = image.width, levelHeight = image.height;
+		for (int l = 0; l < level; l++) {
+			levelWidth = (levelWidth + 1) / 2;
+			levelHeight = (levelHeight + 1) / 2;
+		}
+		float tileWidth = sizex * TILE_PIXELS / levelWidth;
+		float tileHeight = sizey * TILE_PIXELS / levelHeight;
+		int levelTileCols = (levelWidth + TILE_PIXELS - 1) / TILE_PIXELS;
+		int levelTileRows = (levelHeight + TILE_PIXELS - 1) / TILE_PIXELS;
+
+		int firstCol = max((int)((viewXMin - lowerx) / tileWidth), 0);
+		int lastCol = min((int)((viewXMax - lowerx) / tileWidth), levelTileCols - 1);
+		int firstRow = max((int)((viewYMin - lowery) / tileHeight), 0);
+		int lastRow = min((int)((viewYMax - lowery) / tileHeight), levelTileRows - 1);
+		for (int row = firstRow; row <= lastRow; row++) {
+			for (int col = firstCol; col <= lastCol; col++) {
+				// the last row and column are partial tiles
+				float x0 = lowerx + col * tileWidth, y0 = lowery + row * tileHeight;
+				float x1 = min(x0 + tileWidth, lowerx + sizex), y1 = min(y0 + tileHeight, lowery + sizey);
+				tilekey_t tile = {i, level, row, col};
+				if (!drawTile(tile, x0, y0, x1, y1)) wanted.push_back(tile);
+			}
+		}
+	}
+
+	glDisable(GL_TEXTURE_2D);
+	requestTiles(wanted);
+	return;
+}
+
+void parseImageLocation(char *fileName) {
+	int i = 0;
+	float num;
+	coord_t texCoord;
+
+	// get the longitude
+	while((fileName[i] != 'W') && (fileName[i] != 'E')) i++;
+	num = atof(fileName + i + 1);
+
+	// west longitudes are actually negative
+	if (fileName[i] == 'W') texCoord.x = -num;
+	else if (fileName[i] == 'E') texCoord.x = num;
+	else {
+		// error
+		#ifndef ERROR_NOTIFICATION_OFF
+		cerr << "Error: Malformed filename. Should be: path/[E|W]<number>[N|S]<number>.jpg" << endl;
+		#endif
+		return;
+	}
+
+	// get the latitude
+	while((fileName[i] != 'S') && (fileName[i] != 'N')) i++;
+	num = atof(fileName + i + 1);
 	// south latitudes are actually negative
 	if (fileName[i] == 'S') texCoord.y = -num;
 	else if (fileName[i] == 'N') texCoord.y = num;
@@ -2006,103 +5449,154 @@ void parseImageLocation(char *fileName) {
 	return;
 }
 
-void computeColors(GLubyte *weatherColors, int wcsize, float *data, int dataSize) {
-	if (wcsize != 4 * recSize && wcsize != 4 * totalSliceSteps) {
-		unreachable("computeColors");
-		return;
+// Recomputes weatherColors only if the attribute, timestep, transparency or
+// transfer function changed since the last time. Returns true if it did.
+bool updateWeatherColors(void) {
+	colorkey_t key = {weatherAttrNum, currentTimeStep, transparency, transferVersion};
+	if (key.attrNum == weatherColorsKey.attrNum && key.timeStep == weatherColorsKey.timeStep &&
+			key.transparency == weatherColorsKey.transparency &&
+			key.transferVersion == weatherColorsKey.transferVersion) {
+		return false;
 	}
 
-	for (int dataStep = 0; dataStep < wcsize; dataStep += 4) {
-		long totalOffset = (currentTimeStep * dataSize) + (dataStep / 4) - 1;
-		#ifdef DEBUG2
-		printf("timestep = %d totalOffset = %ld\n", currentTimeStep, totalOffset);
-		#endif
+	if (weatherColors == NULL) weatherColors = new GLubyte[4 * recSize];
 
-		#ifndef SLICE_COLOR_ON
-		// only do this for the slice graph
-		if (wcsize == 4 * totalSliceSteps) {
-			// make the line white
-			weatherColors[dataStep + 0] = 255;
-			weatherColors[dataStep + 1] = 255;
-			weatherColors[dataStep + 2] = 255;
-			weatherColors[dataStep + 3] = 0;
-			continue;
+	int attr = dataAttribute(weatherAttrNum);
+	if (!isDailyAttribute(weatherAttrNum)) {
+		computeColors(weatherColors, 4 * recSize, getTimeStep(attr, currentTimeStep));
+	}
+	else if (isDailyAttribute(weatherAttrNum)) {
+		float *prevValues = NULL;
+		if (currentTimeStep > 0) prevValues = getTimeStep(attr, currentTimeStep - 1);
+		computeDailyColors(weatherColors, 4 * recSize, getTimeStep(attr, currentTimeStep), prevValues);
+	}
+	else {
+		unreachable("updateWeatherColors");
+	}
+
+	weatherColorsKey = key;
+	return true;
+}
+
+// Uploads weatherCoords and the joined index strip into buffer objects. Needs
+// a current GL context, so it runs after the main window is created.
+void initWeatherBuffers(void) {
+	const char *version = (const char *)glGetString(GL_VERSION);
+	int major = 0, minor = 0;
+	if (version != NULL) sscanf(version, "%d.%d", &major, &minor);
+	usePrimitiveRestart = (major > 3) || (major == 3 && minor >= 1);
+
+	// join every row's strip into one
+	vector<GLuint> indices;
+	indices.reserve((numRows - 1) * (2 * numCols + 2));
+	for (int currRow = 0; currRow < weatherIndices.size(); currRow++) {
+		if (currRow > 0) {
+			if (usePrimitiveRestart) indices.push_back(RESTART_INDEX);
+			else {
+				// two degenerate triangles; rows have an even count so the winding is kept
+				indices.push_back(indices.back());
+				indices.push_back(weatherIndices[currRow][0]);
+			}
 		}
-		#endif
+		indices.insert(indices.end(), weatherIndices[currRow].begin(), weatherIndices[currRow].end());
+	}
+	weatherIndexCount = indices.size();
+	// the rows aren't needed on the host anymore
+	vector< vector<GLuint> >().swap(weatherIndices);
 
+	glGenBuffers(1, &weatherVertexBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, weatherVertexBuffer);
+	glBufferData(GL_ARRAY_BUFFER, 2 * recSize * sizeof(float), weatherCoords, GL_STATIC_DRAW);
 
-		long tfsize = transFuncData.size();
+	glGenBuffers(1, &weatherColorBuffer);
+	glBindBuffer(GL_ARRAY_BUFFER, weatherColorBuffer);
+	glBufferData(GL_ARRAY_BUFFER, 4 * recSize, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
 
-		float val = data[totalOffset];
+	glGenBuffers(1, &weatherIndexBuffer);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, weatherIndexBuffer);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, weatherIndexCount * sizeof(GLuint), &indices[0], GL_STATIC_DRAW);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
 
-		// check if the value is outside the bounds of the transfer function
-		if (val <= transFuncData[0].value) {
-			weatherColors[dataStep + 0] = transFuncData[0].R;
-			weatherColors[dataStep + 1] = transFuncData[0].G;
-			weatherColors[dataStep + 2] = transFuncData[0].B;
-			#ifdef HIDE_NEGLIGIBLE_DATA
-			weatherColors[dataStep + 3] = NEGLIGIBLE_TRANSPARENCY;
-			#else
-			weatherColors[dataStep + 3] = transparency;
-			#endif
-			continue;
-		}
-		/*
-		#ifdef HIDE_NEGLIGIBLE_DATA
-		else if (val < transFuncData[1].value) {
-			weatherColors[dataStep + 0] = transFuncData[1].R;
-			weatherColors[dataStep + 1] = transFuncData[1].G;
-			weatherColors[dataStep + 2] = transFuncData[1].B;
-			weatherColors[dataStep + 3] = NEGLIGIBLE_TRANSPARENCY;
-			continue;
-		}
-		#endif
-		// */
-		else if (val >= transFuncData[tfsize - 1].value) {
-			weatherColors[dataStep + 0] = transFuncData[tfsize - 1].R;
-			weatherColors[dataStep + 1] = transFuncData[tfsize - 1].G;
-			weatherColors[dataStep + 2] = transFuncData[tfsize - 1].B;
-			weatherColors[dataStep + 3] = transparency;
-			continue;
-		}
-		
-		// calculate the color using transfer function
-		int colorIndex;
-		// find which interval this value lies in
-		for (colorIndex = 0; colorIndex < tfsize; colorIndex++) {
-			if (transFuncData[colorIndex].value > val) break;
-		}
-		
-		// get lower color data
-		GLubyte red1 = transFuncData[colorIndex - 1].R;
-		GLubyte green1 = transFuncData[colorIndex - 1].G;
-		GLubyte blue1 = transFuncData[colorIndex - 1].B;
-		float lowVal = transFuncData[colorIndex - 1].value;
-		
-		// get upper color data
-		GLubyte red2 = transFuncData[colorIndex].R;
-		GLubyte green2 = transFuncData[colorIndex].G;
-		GLubyte blue2 = transFuncData[colorIndex].B;
-		float highVal = transFuncData[colorIndex].value;
-		
-		float diff = highVal - lowVal;
+	#ifdef CONSOLE_OUTPUT
+	printf("Weather grid uploaded: %d indices, %s.\n", (int)weatherIndexCount,
+			usePrimitiveRestart ? "primitive restart" : "degenerate triangles");
+	#endif
+	return;
+}
+
+// draws the whole weather grid with one call
+void drawWeatherGrid(void) {
+	// only recompute and upload the colors when what they depend on has changed
+	if (updateWeatherColors()) {
+		glBindBuffer(GL_ARRAY_BUFFER, weatherColorBuffer);
+		// orphan the old storage so we don't wait on a frame still drawing from it
+		glBufferData(GL_ARRAY_BUFFER, 4 * recSize, NULL, GL_STREAM_DRAW);
+		glBufferSubData(GL_ARRAY_BUFFER, 0, 4 * recSize, weatherColors);
+	}
+
+	glEnableClientState(GL_COLOR_ARRAY);
+	glEnableClientState(GL_VERTEX_ARRAY);
+
+	glBindBuffer(GL_ARRAY_BUFFER, weatherColorBuffer);
+	glColorPointer(4, GL_UNSIGNED_BYTE, 0, 0);
+	glBindBuffer(GL_ARRAY_BUFFER, weatherVertexBuffer);
+	glVertexPointer(2, GL_FLOAT, 0, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, weatherIndexBuffer);
+
+	if (usePrimitiveRestart) {
+		glEnable(GL_PRIMITIVE_RESTART);
+		glPrimitiveRestartIndex(RESTART_INDEX);
+	}
+	glDrawElements(GL_TRIANGLE_STRIP, weatherIndexCount, GL_UNSIGNED_INT, 0);
+	if (usePrimitiveRestart) glDisable(GL_PRIMITIVE_RESTART);
+
+	// everything else still draws from client memory
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+	return;
+}
+
+// values holds one record (or the slice data) of the current attribute
+// wcsize can be any number of values, so it also colors the slice graph
+// and the Hovmoller image
+void computeColors(GLubyte *weatherColors, int wcsize, const float *values) {
+	if (wcsize % 4 != 0) {
+		unreachable("computeColors");
+		return;
+	}
 
-		// linearly interpolate the new color
-		GLubyte newRed = (1.0 - ((val - lowVal)/diff))*red1 + (1.0 - ((highVal - val)/diff))*red2;
-		GLubyte newGreen = (1.0 - ((val - lowVal)/diff))*green1 + (1.0 - ((highVal - val)/diff))*green2;
-		GLubyte newBlue = (1.0 - ((val - lowVal)/diff))*blue1 + (1.0 - ((highVal - val)/diff))*blue2;
+	if (transLUTAlpha != transparency) setTransferLUTAlpha(transparency);
 
-		// save the color
-		weatherColors[dataStep + 0] = newRed;
-		weatherColors[dataStep + 1] = newGreen;
-		weatherColors[dataStep + 2] = newBlue;
-		weatherColors[dataStep + 3] = transparency;
+	// keep this loop branch free so it vectorizes
+	int numValues = wcsize / 4;
+	for (int i = 0; i < numValues; i++) {
+		memcpy(&weatherColors[4 * i], &transLUT[4 * transferLUTIndex(values[i])], 4);
 	}
 	return;
 }
 
-void computeDailyColors(GLubyte *weatherColors, int wcsize, float *data, int dataSize) {
-	if (wcsize != 4 * recSize && wcsize != 4 * totalSliceSteps) {
+// the slice graph is drawn white unless SLICE_COLOR_ON is defined
+void computeSliceLineColors(GLubyte *sliceColors, int scsize, const float *sliceData) {
+	#ifdef SLICE_COLOR_ON
+	computeColors(sliceColors, scsize, sliceData);
+	#else
+	for (int dataStep = 0; dataStep < scsize; dataStep += 4) {
+		sliceColors[dataStep + 0] = 255;
+		sliceColors[dataStep + 1] = 255;
+		sliceColors[dataStep + 2] = 255;
+		sliceColors[dataStep + 3] = 0;
+	}
+	#endif
+	return;
+}
+
+// prevValues is the record from the previous timestep, NULL at the first timestep
+void computeDailyColors(GLubyte *weatherColors, int wcsize, const float *values, const float *prevValues) {
+	if (wcsize % 4 != 0) {
 		unreachable("computeDailyColors");
 		return;
 	}
@@ -2146,25 +5640,11 @@ void computeDailyColors(GLubyte *weatherColors, int wcsize, float *data, int dat
 	float max = weatherAttrMax[weatherAttrNum];
 
 	for (int dataStep = 0; dataStep < wcsize; dataStep += 4) {
-		#ifndef SLICE_COLOR_ON
-		// only do this for the slice graph
-		if (wcsize == 4 * totalSliceSteps) {
-			// make the line white
-			weatherColors[dataStep + 0] = 255;
-			weatherColors[dataStep + 1] = 255;
-			weatherColors[dataStep + 2] = 255;
-			weatherColors[dataStep + 3] = 0;
-			continue;
-		}
-		#endif
+		float accumulated = values[dataStep / 4];
 
-		long totalOffset = (currentTimeStep * dataSize) + (dataStep / 4) - 1;
-
-		float accumulated = data[totalOffset];
-
-		if (currentTimeStep == 0) current = 0.0;
+		if (prevValues == NULL) current = 0.0;
 		// subtract the total accumulated from the last timestep's accumulated to get daily
-		else current = accumulated - data[totalOffset - dataSize];
+		else current = accumulated - prevValues[dataStep / 4];
 
 		float highSpan = max - EPSILON;
 		float lowSpan = -(min + EPSILON);
@@ -2215,7 +5695,7 @@ void computeDailyColors(GLubyte *weatherColors, int wcsize, float *data, int dat
 	return;
 }
 
-void computeSliceCoords(float *sliceCoords, int cosize, float *sliceData, float *prevSliceData) {
+void computeSliceCoords(float *sliceCoords, int cosize, const float *sliceData, const float *prevSliceData) {
 	#ifdef DEBUG2
 	printf("computeSliceCoords()\n");
 	#endif
@@ -2227,10 +5707,10 @@ void computeSliceCoords(float *sliceCoords, int cosize, float *sliceData, float
 		float scalingFactor = SLICE_GRAPH_HEIGHT / weatherAttrMax[weatherAttrNum];
 		float foo = scalingFactor * sliceData[i];
 
-		if (weatherAttrNum >= ATTR_MIN && weatherAttrNum < 4) {
+		if (!isDailyAttribute(weatherAttrNum)) {
 			// use the accumulated value
 		}
-		else if (weatherAttrNum >= 4 && weatherAttrNum <= ATTR_MAX) {
+		else if (isDailyAttribute(weatherAttrNum)) {
 			// use the difference in values
 			float previous;
 			if (currentTimeStep == 0) previous = 0.0;
@@ -2252,7 +5732,10 @@ void allocateWeatherDataSpace(NcFile *ncF) {
 	NcValues *snowVals = snowVar->get_rec();
 	const long snowRecByteSize = snowVals->num() * snowVals->bytes_for_one();
 	long snowByteSize = numNcFiles * timeSize * snowRecSize;
-	snowpackData = new float[snowByteSize];
+	// all 4 attributes in one mapping the ingest workers share
+	weatherDataSize = 4 * snowByteSize * sizeof(float);
+	weatherDataMap = sharedAlloc(weatherDataSize);
+	snowpackData = (float *)weatherDataMap;
 	
 	// SNOWNC: snowfall
 	NcVar *snowncVar = ncF->get_var("SNOWNC");
@@ -2260,7 +5743,7 @@ void allocateWeatherDataSpace(NcFile *ncF) {
 	NcValues *snowncVals = snowncVar->get_rec();
 	long snowncRecByteSize = snowncVals->num() * snowncVals->bytes_for_one();
 	long snowncByteSize = numNcFiles * timeSize * snowncRecSize;
-	snowfallData = new float[snowncByteSize];
+	snowfallData = snowpackData + snowncByteSize;
 
 	#ifdef DEBUG2
 	cout << "snowRecSize = " << snowRecSize << endl;
@@ -2282,7 +5765,7 @@ void allocateWeatherDataSpace(NcFile *ncF) {
 	long rainncRecByteSize = rainncVals->num() * rainncVals->bytes_for_one();
 	long raincByteSize = numNcFiles * timeSize * raincRecSize;
 	long rainncByteSize = numNcFiles * timeSize * rainncRecSize;
-	precipitationData = new float[raincByteSize];
+	precipitationData = snowfallData + raincByteSize;
 	#ifdef DEBUG2
 	cout << "raincRecSize = " << raincRecSize << endl;
 	cout << "raincRecByteSize = " << raincRecByteSize << endl;
@@ -2302,7 +5785,7 @@ void allocateWeatherDataSpace(NcFile *ncF) {
 	long udroffRecByteSize = udroffVals->num() * udroffVals->bytes_for_one();
 	long sfroffByteSize = numNcFiles * timeSize * sfroffRecSize;
 	long udroffByteSize = numNcFiles * timeSize * udroffRecSize;
-	runoffData = new float[sfroffByteSize];
+	runoffData = precipitationData + sfroffByteSize;
 
 	#ifdef DEBUG2
 	cout << "sfroffRecSize = " << sfroffRecSize << endl;
@@ -2395,18 +5878,28 @@ void precomputeWeatherParameters(NcFile *ncF) {
 
 	// get the latitude and longitude of each data point
 	for (int i = 0; i < recSize; i++) {
-		float x = xVals->as_float(i);
-		float y = yVals->as_float(i);
 		// the coords are interleaved for rendering
-		weatherCoords[2 * i] = x;
-		weatherCoords[2 * i + 1] = y;
+		weatherCoords[2 * i] = xVals->as_float(i);
+		weatherCoords[2 * i + 1] = yVals->as_float(i);
+	}
+	// END
+
+	precomputeGridParameters();
+	return;
+}
+
+// everything below only depends on weatherCoords, numRows and numCols
+void precomputeGridParameters(void) {
+	for (int i = 0; i < recSize; i++) {
+		float x = weatherCoords[2 * i];
+		float y = weatherCoords[2 * i + 1];
 
 		// update min/max as necessary
 		if (x > xMax) xMax = x;
-		else if (x < xMin) xMin = x;
+		if (x < xMin) xMin = x;
 
 		if (y > yMax) yMax = y;
-		else if (y < yMin) yMin = y;
+		if (y < yMin) yMin = y;
 	}
 
 	// center the view
@@ -2423,10 +5916,9 @@ void precomputeWeatherParameters(NcFile *ncF) {
 	cout << "yMin = " << yMin << ", yMax = " << yMax << endl;
 	cout << "xMid = " << xMid << ", yMid = " << yMid << endl;
 	#endif
-	// END
 
 	// precompute the index data
-	for (int currRow = 0; currRow < numRows; currRow++) {
+	for (int currRow = 0; currRow < numRows - 1; currRow++) {
 		weatherIndices.push_back(gluintVector);
 		for (int currCol = 0; currCol < numCols; currCol++) {
 			// precompute the index data only once
@@ -2481,172 +5973,214 @@ void precomputeWeatherParameters(NcFile *ncF) {
 		weatherOutline.push_back(1.0);
 		weatherOutline.push_back(0.0);
 	}
+
+	buildCellIndex();
 	return;
 }
 
-void computeMaxsAndMins(void) {
-	// update min/max as necessary
-	for (int i = 0; i < totalTimeSteps; i++) {
-		long timeStepOffset = i * recSize;
-		for (int j = 0; j < recSize; j++) {
-			long totalOffset = timeStepOffset + j;
-
-			float val;
-
-			val = snowpackData[totalOffset];
-			if (val > weatherAttrMax[SNOWPACK]) weatherAttrMax[SNOWPACK] = val;
-			if (val < weatherAttrMin[SNOWPACK]) weatherAttrMin[SNOWPACK] = val;
-
-			val = snowfallData[totalOffset];
-			if (val > weatherAttrMax[SNOWFALL]) weatherAttrMax[SNOWFALL] = val;
-			if (val < weatherAttrMin[SNOWFALL]) weatherAttrMin[SNOWFALL] = val;
-			
-			val = precipitationData[totalOffset];
-			if (val > weatherAttrMax[PRECIPITATION]) weatherAttrMax[PRECIPITATION] = val;
-			if (val < weatherAttrMin[PRECIPITATION]) weatherAttrMin[PRECIPITATION] = val;
-			
-			val = runoffData[totalOffset];
-			if (val > weatherAttrMax[RUNOFF]) weatherAttrMax[RUNOFF] = val;
-			if (val < weatherAttrMin[RUNOFF]) weatherAttrMin[RUNOFF] = val;
+// Both files are mapped and tokenized in place. Lines can end in LF, CR or
+// CRLF. The header row of the data file maps each column to the station with
+// that ID in the location file.
+void parseCSVfiles(char *locFileName, char *dataFileName) {
+	size_t locSize, dataSize;
+	vector< pair<const char *, const char *> > fields, header;
+	const char *lineEnd;
+
+	char *locFile = mapCSVFile(locFileName, locSize);
+	if (locFile == NULL) return;
+
+	const char *end = locFile + locSize;
+	const char *p = nextCSVLine(locFile, end, lineEnd);
+	splitCSVLine(locFile, lineEnd, header);
+	int idCol = findCSVColumn(header, "ID", 0);
+	int latCol = findCSVColumn(header, "Lat", 1);
+	int lonCol = findCSVColumn(header, "Lon", 2);
+	#ifdef DRAWING_3D
+	int elevCol = findCSVColumn(header, "Elevation", 3);
+	#endif
 
-			float delta;
+	// station IDs to their index in csvCoords
+	map<string, int> stationIndex;
 
-			if (i == 0) delta = 0.0;
-			else delta = snowpackData[totalOffset] - snowpackData[totalOffset - recSize];
+	// get the location data
+	while (p < end) {
+		const char *line = p;
+		p = nextCSVLine(p, end, lineEnd);
+		splitCSVLine(line, lineEnd, fields);
+		if (fields.size() <= max(idCol, max(latCol, lonCol))) continue;
+
+		coord_t coord = {0.0, 0.0, 0.0};
+		bool valid = parseCSVFloat(fields[latCol].first, fields[latCol].second, coord.y);
+		valid &= parseCSVFloat(fields[lonCol].first, fields[lonCol].second, coord.x);
+		if (!valid) {
+			#ifndef ERROR_NOTIFICATION_OFF
+			cerr << "Error: Bad station location in " << locFileName << ". Skipping it." << endl;
+			#endif
+			continue;
+		}
+		#ifdef DRAWING_3D
+		if (elevCol < fields.size()) parseCSVFloat(fields[elevCol].first, fields[elevCol].second, coord.z);
+		#endif
 
-			if (delta > weatherAttrMax[SNOWPACK_DAILY]) weatherAttrMax[SNOWPACK_DAILY] = delta;
-			if (delta < weatherAttrMin[SNOWPACK_DAILY]) weatherAttrMin[SNOWPACK_DAILY] = delta;
+		string id(fields[idCol].first, fields[idCol].second);
+		stationIndex[id] = csvCoords.size();
+		csvNames.push_back(id);
+		csvCoords.push_back(coord);
+	}
+	munmap(locFile, locSize);
+	numCsvStations = csvCoords.size();
+
+	char *dataFile = mapCSVFile(dataFileName, dataSize);
+	if (dataFile == NULL) return;
+
+	end = dataFile + dataSize;
+	p = nextCSVLine(dataFile, end, lineEnd);
+	splitCSVLine(dataFile, lineEnd, header);
+	int dayCol = findCSVColumn(header, "DAY", 0);
+
+	// the station each column holds, -1 for unknown stations
+	vector<int> columnStation(header.size(), -1);
+	for (int col = 0; col < header.size(); col++) {
+		if (col == dayCol) continue;
+		map<string, int>::iterator it = stationIndex.find(string(header[col].first, header[col].second));
+		if (it != stationIndex.end()) columnStation[col] = it->second;
+		#ifndef ERROR_NOTIFICATION_OFF
+		else cerr << "Error: No location for station " << string(header[col].first, header[col].second) << endl;
+		#endif
+	}
 
-			delta = snowfallData[totalOffset] - snowfallData[totalOffset - recSize];
-			if (delta > weatherAttrMax[SNOWFALL_DAILY]) weatherAttrMax[SNOWFALL_DAILY] = delta;
-			if (delta < weatherAttrMin[SNOWFALL_DAILY]) weatherAttrMin[SNOWFALL_DAILY] = delta;
-			
-			delta = precipitationData[totalOffset] - precipitationData[totalOffset - recSize];
-			if (delta > weatherAttrMax[PRECIPITATION_DAILY]) weatherAttrMax[PRECIPITATION_DAILY] = delta;
-			if (delta < weatherAttrMin[PRECIPITATION_DAILY]) weatherAttrMin[PRECIPITATION_DAILY] = delta;
-			
-			delta = runoffData[totalOffset] - runoffData[totalOffset - recSize];
-			if (delta > weatherAttrMax[RUNOFF_DAILY]) weatherAttrMax[RUNOFF_DAILY] = delta;
-			if (delta < weatherAttrMin[RUNOFF_DAILY]) weatherAttrMin[RUNOFF_DAILY] = delta;
+	// get the snowpack data until EOF is reached
+	while (p < end) {
+		const char *line = p;
+		p = nextCSVLine(p, end, lineEnd);
+		// skip blank lines
+		if (line == lineEnd) continue;
+		splitCSVLine(line, lineEnd, fields);
+
+		float day = 0.0;
+		if (dayCol < fields.size()) parseCSVFloat(fields[dayCol].first, fields[dayCol].second, day);
+		csvDays.push_back((int)day);
+
+		// every station starts out missing for this day
+		long rowStart = csvData.size();
+		csvData.resize(rowStart + numCsvStations, CSV_MISSING);
+		for (int col = 0; col < fields.size() && col < columnStation.size(); col++) {
+			if (columnStation[col] < 0) continue;
+
+			float value;
+			if (!parseCSVFloat(fields[col].first, fields[col].second, value)) continue;
+			csvData[rowStart + columnStation[col]] = value;
+			// update min/max as necessary
+			if (value < csvMin) csvMin = value;
+			if (value > csvMax) csvMax = value;
 		}
+		numCsvDays++;
 	}
+	munmap(dataFile, dataSize);
 
-	#ifdef DEBUG2
-	// print out mins/maxs
-	cout << "snowpackMin = " << weatherAttrMin[SNOWPACK] << endl;
-	cout << "snowpackMax = " << weatherAttrMax[SNOWPACK] << endl;
-	cout << "snowfallMin = " << weatherAttrMin[SNOWFALL] << endl;
-	cout << "snowfallMax = " << weatherAttrMax[SNOWFALL] << endl;
-	cout << "precipitationMin = " << weatherAttrMin[PRECIPITATION] << endl;
-	cout << "precipitationMax = " << weatherAttrMax[PRECIPITATION] << endl;
-	cout << "runoffMin = " << weatherAttrMin[RUNOFF] << endl;
-	cout << "runoffMax = " << weatherAttrMax[RUNOFF] << endl;
-	cout << "snowpackDailyMin = " << weatherAttrMin[4] << endl;
-	cout << "snowpackDailyMax = " << weatherAttrMax[4] << endl;
-	cout << "snowfallDailyMin = " << weatherAttrMin[5] << endl;
-	cout << "snowfallDailyMax = " << weatherAttrMax[5] << endl;
-	cout << "precipitationDailyMin = " << weatherAttrMin[6] << endl;
-	cout << "precipitationDailyMax = " << weatherAttrMax[6] << endl;
-	cout << "runoffDailyMin = " << weatherAttrMin[7] << endl;
-	cout << "runoffDailyMax = " << weatherAttrMax[7] << endl;
+	#ifdef CONSOLE_OUTPUT
+	printf("Read %d days of data for %d stations.\n", numCsvDays, numCsvStations);
 	#endif
-
 	return;
 }
 
-void parseCSVfiles(char *locFileName, char *dataFileName) {
-	string line, cell;
-	int i, j;
-	coord_t coord;
+// maps a whole file read only, NULL if it can't be read or is empty
+char *mapCSVFile(char *fileName, size_t &size) {
+	struct stat st;
+	int fd = (fileName == NULL) ? -1 : open(fileName, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+		#ifndef ERROR_NOTIFICATION_OFF
+		cerr << "Error: Couldn't read " << (fileName ? fileName : "(null)") << endl;
+		#endif
+		if (fd >= 0) close(fd);
+		return NULL;
+	}
 
-	// There's a problem with the line endings for the csv files
-	// It's not recognizing ^M as newline
-	// TODO: must modify source file to replace ^M with space then back again
-	// in vim: ":%s/^vm/ /g" then ":%s/ /^vm/g" and it's fixed
-	// "^vm" means you must hold ctrl+v while pressing m
+	size = st.st_size;
+	void *map = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) return NULL;
+	return (char *)map;
+}
 
-	ifstream locStream(locFileName);
+// Sets lineEnd to the end of the line starting at p and returns where the
+// next line starts. Lines can end in LF, CR or CRLF.
+const char *nextCSVLine(const char *p, const char *end, const char *&lineEnd) {
+	while (p < end && *p != '\n' && *p != '\r') p++;
+	lineEnd = p;
+	if (p < end && *p == '\r') p++;
+	if (p < end && *p == '\n' && (p == lineEnd || *lineEnd == '\r')) p++;
+	return p;
+}
 
-	i = 0;
-	// get the location data
-    while(getline(locStream, line)) {
-		// handle the first line of entry decriptors separately
-		if (i == 0) {
-			i++;
-			continue;
+// points each field at its characters in the mapped file, nothing is copied
+void splitCSVLine(const char *line, const char *lineEnd, vector< pair<const char *, const char *> > &fields) {
+	fields.clear();
+	const char *fieldStart = line;
+	for (const char *p = line; p <= lineEnd; p++) {
+		if (p == lineEnd || *p == ',') {
+			const char *first = fieldStart, *last = p;
+			// trim spaces
+			while (first < last && *first == ' ') first++;
+			while (last > first && last[-1] == ' ') last--;
+			fields.push_back(make_pair(first, last));
+			fieldStart = p + 1;
 		}
-        stringstream lineStream(line);
-
-		j = 0;
-		// get the entries one at a time
-        while(getline(lineStream, cell, ',')) {
-			#ifdef DEBUG2
-            printf("j = %d cell = %s\n", j, cell.c_str());
-			#endif
-
-			if (j == 1) coord.y = atof(cell.c_str());
-			else if (j == 2) coord.x = atof(cell.c_str());
-			else if (j == 3) {
-				#ifdef DRAWING_3D
-				coord.z = atof(cell.c_str());
-				#else
-				coord.z = 0.0;
-				#endif
-			}
-			else if (j != 0) {
-				#ifndef ERROR_NOTIFICATION_OFF
-				cerr << "Error: Coord has more than 3 values. " <<
-						"Are you sure this is the location csv file?" << endl;
-				#endif
-				return;
-			}
-			j++;
-        }
-
-		// finished with this line of data
-		csvCoords.push_back(coord);
-		i++;
-    }
-
-	ifstream dataStream(dataFileName);
-
-	i = 0;
-	// get the snowpack data until EOF is reached
-    while(getline(dataStream, line)) {
-		vector<float> rowData;
+	}
+	return;
+}
 
-		// skip the line with column names
-		if (i == 0) {
-			i++;
-			continue;
+// Parses a decimal number that fills [begin,end). Returns false if the field
+// is empty or isn't a number.
+bool parseCSVFloat(const char *begin, const char *end, float &value) {
+	const char *p = begin;
+	double mantissa = 0.0;
+	int exponent = 0;
+	bool negative = false, sawDigit = false;
+
+	if (p < end && (*p == '-' || *p == '+')) negative = (*p++ == '-');
+	for (; p < end && *p >= '0' && *p <= '9'; p++) {
+		mantissa = 10.0 * mantissa + (*p - '0');
+		sawDigit = true;
+	}
+	if (p < end && *p == '.') {
+		for (p++; p < end && *p >= '0' && *p <= '9'; p++) {
+			mantissa = 10.0 * mantissa + (*p - '0');
+			exponent--;
+			sawDigit = true;
 		}
+	}
+	if (!sawDigit) return false;
+
+	if (p < end && (*p == 'e' || *p == 'E')) {
+		bool negativeExp = false;
+		int exp = 0;
+		p++;
+		if (p < end && (*p == '-' || *p == '+')) negativeExp = (*p++ == '-');
+		if (p == end || *p < '0' || *p > '9') return false;
+		// anything this big over or underflows a float anyway
+		for (; p < end && *p >= '0' && *p <= '9'; p++) {
+			if (exp < 1000) exp = 10 * exp + (*p - '0');
+		}
+		exponent += negativeExp ? -exp : exp;
+	}
+	if (p != end) return false;
 
-        stringstream lineStream(line);
-
-		j = 0;
-		// get the entries one at a time
-        while(getline(lineStream, cell, ',')) {
-			#ifdef DEBUG2
-            printf("j = %d cell = %s\n", j, cell.c_str());
-			#endif
+	if (exponent != 0) mantissa *= pow(10.0, exponent);
+	value = negative ? -mantissa : mantissa;
+	return true;
+}
 
-			if (j == 0) {
-				j++;
-				continue;
-			}
-			// push data for this station
-			float value = atof(cell.c_str());
-			rowData.push_back(value);
-			j++;
-			// update min/max as necessary
-			if (value < csvMin) csvMin = value;
-			else if (value > csvMax) csvMax = value;
-        }
-		// push all the data for this timestep(day)
-		csvData.push_back(rowData);
-		i++;
+// index of the header field equal to name, or fallback if there isn't one
+int findCSVColumn(const vector< pair<const char *, const char *> > &header, const char *name, int fallback) {
+	int length = strlen(name);
+	for (int col = 0; col < header.size(); col++) {
+		if (header[col].second - header[col].first == length &&
+				strncasecmp(header[col].first, name, length) == 0) {
+			return col;
+		}
 	}
-	return;
+	return fallback;
 }
 
 void parseTransferFile(char *fileName) {
@@ -2705,9 +6239,90 @@ void parseTransferFile(char *fileName) {
 		#endif
 		exit(1);
 	}
+
+	buildTransferLUT();
+	return;
+}
+
+// linearly interpolates the transfer function color for val
+void interpolateTransfer(float val, GLubyte &R, GLubyte &G, GLubyte &B) {
+	long tfsize = transFuncData.size();
+
+	// check if the value is outside the bounds of the transfer function
+	if (val <= transFuncData[0].value) {
+		R = transFuncData[0].R;
+		G = transFuncData[0].G;
+		B = transFuncData[0].B;
+		return;
+	}
+	else if (val >= transFuncData[tfsize - 1].value) {
+		R = transFuncData[tfsize - 1].R;
+		G = transFuncData[tfsize - 1].G;
+		B = transFuncData[tfsize - 1].B;
+		return;
+	}
+
+	int colorIndex;
+	// find which interval this value lies in
+	for (colorIndex = 0; colorIndex < tfsize; colorIndex++) {
+		if (transFuncData[colorIndex].value > val) break;
+	}
+
+	trans_t low = transFuncData[colorIndex - 1];
+	trans_t high = transFuncData[colorIndex];
+	float diff = high.value - low.value;
+
+	// linearly interpolate the new color
+	R = (1.0 - ((val - low.value)/diff))*low.R + (1.0 - ((high.value - val)/diff))*high.R;
+	G = (1.0 - ((val - low.value)/diff))*low.G + (1.0 - ((high.value - val)/diff))*high.G;
+	B = (1.0 - ((val - low.value)/diff))*low.B + (1.0 - ((high.value - val)/diff))*high.B;
+	return;
+}
+
+// compiles transFuncData into transLUT, sampling each bin at its center
+void buildTransferLUT(void) {
+	float lowVal = transFuncData[0].value;
+	float highVal = transFuncData[transFuncData.size() - 1].value;
+
+	transLUTMin = lowVal;
+	if (highVal > lowVal) transLUTScale = TRANS_LUT_SIZE / (highVal - lowVal);
+	else transLUTScale = 0.0;
+
+	interpolateTransfer(lowVal, transLUT[0], transLUT[1], transLUT[2]);
+	for (int bin = 0; bin < TRANS_LUT_SIZE; bin++) {
+		float val = lowVal + (bin + 0.5) * (highVal - lowVal) / TRANS_LUT_SIZE;
+		GLubyte *color = &transLUT[4 * (bin + 1)];
+		interpolateTransfer(val, color[0], color[1], color[2]);
+	}
+
+	setTransferLUTAlpha(transparency);
+	transferVersion++;
+	return;
+}
+
+// fills the alpha channel of transLUT, done again whenever transparency changes
+void setTransferLUTAlpha(GLubyte alpha) {
+	#ifdef HIDE_NEGLIGIBLE_DATA
+	transLUT[3] = NEGLIGIBLE_TRANSPARENCY;
+	#else
+	transLUT[3] = alpha;
+	#endif
+	for (int bin = 1; bin <= TRANS_LUT_SIZE; bin++) {
+		transLUT[4 * bin + 3] = alpha;
+	}
+	transLUTAlpha = alpha;
 	return;
 }
 
+// index of the transLUT entry for val
+inline int transferLUTIndex(float val) {
+	float bin = (val - transLUTMin) * transLUTScale;
+	// clamp, written as selects so the callers' loops vectorize
+	bin = (bin < 0.0f) ? 0.0f : bin;
+	bin = (bin > TRANS_LUT_SIZE - 1) ? TRANS_LUT_SIZE - 1 : bin;
+	return (val <= transLUTMin) ? 0 : 1 + (int)bin;
+}
+
 // this function uses the equations:
 // c.x = (1-t)*a.x + t*b.x
 // c.y = (1-t)*a.y + t*b.y
@@ -2782,26 +6397,408 @@ void unreachable(char *funcName) {
 
 // this function is run just before the program exits
 void cleanUpMemory(void) {
-	delete [] snowpackData;
-	delete [] snowfallData;
-	delete [] precipitationData;
-	delete [] runoffData;
-	delete [] textures;
+	if (timeMajorThreadStarted) {
+		// the builder may still be reading the attribute arrays
+		pthread_mutex_lock(&timeMajorMutex);
+		timeMajorStop = true;
+		pthread_mutex_unlock(&timeMajorMutex);
+		pthread_join(timeMajorThread, NULL);
+	}
+	for (int attr = 0; attr < 4; attr++) delete [] timeMajorData[attr];
+
+	// the encoders finish the frames already queued
+	pthread_mutex_lock(&captureMutex);
+	captureStop = true;
+	pthread_cond_broadcast(&captureReady);
+	pthread_mutex_unlock(&captureMutex);
+	for (int i = 0; i < encoderThreads.size(); i++) pthread_join(encoderThreads[i], NULL);
+
+	// the tile loaders may still be writing pixels
+	pthread_mutex_lock(&tileMutex);
+	tileLoaderStop = true;
+	pthread_cond_broadcast(&tileCond);
+	pthread_mutex_unlock(&tileMutex);
+	for (int i = 0; i < tileLoaderThreads.size(); i++) {
+		pthread_join(tileLoaderThreads[i], NULL);
+	}
+	for (int i = 0; i < tilesDecoded.size(); i++) delete [] tilesDecoded[i].pixels;
+
+	if (streaming) {
+		// the loader may be writing into the ring buffer
+		pthread_mutex_lock(&streamMutex);
+		streamStop = true;
+		pthread_cond_broadcast(&streamCond);
+		pthread_mutex_unlock(&streamMutex);
+		if (streamThreadStarted) pthread_join(streamThread, NULL);
+
+		delete [] weatherCoords;
+		delete [] streamData;
+		delete [] streamSlotStep;
+		delete [] streamSlotLoading;
+	}
+	else if (weatherCacheMap != NULL) {
+		munmap(weatherCacheMap, weatherCacheSize);
+	}
+	else {
+		delete [] weatherCoords;
+		if (weatherDataMap != NULL) munmap(weatherDataMap, weatherDataSize);
+	}
+	delete [] weatherColors;
+	delete [] hovmollerData;
+	delete [] hovmollerColors;
+	delete [] observedData;
+	if (headlessDisplay != EGL_NO_DISPLAY) {
+		eglMakeCurrent(headlessDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+		eglTerminate(headlessDisplay);
+	}
+	for (int fileNum = 0; fileNum < shapeFiles.size(); fileNum++) {
+		shapedata_t &shapes = shapeFiles[fileNum];
+		if (shapes.map != NULL) munmap(shapes.map, shapes.mapSize);
+		else {
+			delete [] shapes.entityStart;
+			delete [] shapes.partStart;
+			delete [] shapes.coords;
+		}
+	}
 
 	printf("Simulation Complete.\n");
 	return;
 }
 
+// writes RGBA pixels, bottom row first as GL reads them, to an RGB PNG
+bool writePNG(const char *fileName, const unsigned char *pixels, int width, int height) {
+	FILE *fout = fopen(fileName, "wb");
+	if (fout == NULL) return false;
+
+	png_structp png = png_create_write_struct(PNG_LIBPNG_VER_STRING, NULL, NULL, NULL);
+	png_infop info = (png == NULL) ? NULL : png_create_info_struct(png);
+	if (info == NULL || setjmp(png_jmpbuf(png))) {
+		png_destroy_write_struct(&png, &info);
+		fclose(fout);
+		unlink(fileName);
+		return false;
+	}
+
+	png_init_io(png, fout);
+	// the frames are big and alike, a fast level compresses them nearly as well
+	png_set_compression_level(png, 3);
+	png_set_IHDR(png, info, width, height, 8, PNG_COLOR_TYPE_RGB, PNG_INTERLACE_NONE,
+			PNG_COMPRESSION_TYPE_DEFAULT, PNG_FILTER_TYPE_DEFAULT);
+	png_write_info(png, info);
+	// drop the alpha, it's whatever blending left in the framebuffer
+	png_set_filler(png, 0, PNG_FILLER_AFTER);
+	for (int y = height - 1; y >= 0; y--) {
+		png_write_row(png, (png_bytep)(pixels + 4L * width * y));
+	}
+	png_write_end(png, NULL);
+	png_destroy_write_struct(&png, &info);
+	return fclose(fout) == 0;
+}
+
+// worker of the encoder pool, only stops once every queued frame is written
+void *frameEncoder(void *arg) {
+	pthread_mutex_lock(&captureMutex);
+	while (true) {
+		while (!captureStop && captureQueue.empty()) pthread_cond_wait(&captureReady, &captureMutex);
+		if (captureQueue.empty()) break;
+
+		captureframe_t frame = captureQueue.front();
+		captureQueue.pop_front();
+		captureEncoding++;
+		// there's room in the queue again
+		pthread_cond_broadcast(&captureDone);
+		pthread_mutex_unlock(&captureMutex);
+
+		if (!writePNG(frame.fileName.c_str(), frame.pixels, frame.width, frame.height)) {
+			#ifndef ERROR_NOTIFICATION_OFF
+			fprintf(stderr, "Error: Couldn't save %s.\n", frame.fileName.c_str());
+			#endif
+		}
+		delete [] frame.pixels;
+
+		pthread_mutex_lock(&captureMutex);
+		captureEncoding--;
+		pthread_cond_broadcast(&captureDone);
+	}
+	pthread_mutex_unlock(&captureMutex);
+	return NULL;
+}
+
+// starts the encoders the first time a frame is captured, one per core(or -j)
+void startFrameEncoders(void) {
+	static bool started = false;
+	if (started) return;
+	started = true;
+
+	int numThreads = (numIngestThreads > 0) ? numIngestThreads : sysconf(_SC_NPROCESSORS_ONLN);
+	numThreads = max(numThreads, 1);
+	for (int i = 0; i < numThreads; i++) {
+		pthread_t thread;
+		if (pthread_create(&thread, NULL, frameEncoder, NULL) == 0) encoderThreads.push_back(thread);
+	}
+
+	#ifndef ERROR_NOTIFICATION_OFF
+	if (encoderThreads.empty()) {
+		fprintf(stderr, "Error: Couldn't start the frame encoders. Frames will be saved as they're captured.\n");
+	}
+	#endif
+	return;
+}
+
+// hands a frame to the encoders, waiting while the queue is full
+void queueFrame(captureframe_t &frame) {
+	if (encoderThreads.empty()) {
+		writePNG(frame.fileName.c_str(), frame.pixels, frame.width, frame.height);
+		delete [] frame.pixels;
+		return;
+	}
+
+	pthread_mutex_lock(&captureMutex);
+	double start = wallTime();
+	while (captureQueue.size() >= CAPTURE_QUEUE_SIZE) pthread_cond_wait(&captureDone, &captureMutex);
+	captureWaitTime += wallTime() - start;
+	captureQueue.push_back(frame);
+	pthread_cond_signal(&captureReady);
+	pthread_mutex_unlock(&captureMutex);
+	return;
+}
+
+// queues the frame whose transfer went into capturePBOs[pbo], if there is one
+void queueCapturedPBO(int pbo) {
+	if (capturePBONames[pbo].empty()) return;
+
+	captureframe_t frame;
+	frame.fileName = capturePBONames[pbo];
+	frame.width = capturePBOWidth;
+	frame.height = capturePBOHeight;
+	long size = 4L * frame.width * frame.height;
+
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, capturePBOs[pbo]);
+	const void *data = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+	if (data != NULL) {
+		frame.pixels = new unsigned char[size];
+		memcpy(frame.pixels, data, size);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	capturePBONames[pbo].clear();
+
+	if (data != NULL) queueFrame(frame);
+	#ifndef ERROR_NOTIFICATION_OFF
+	else fprintf(stderr, "Error: Couldn't read back %s.\n", frame.fileName.c_str());
+	#endif
+	return;
+}
+
+// Starts reading back the frame just drawn, to be saved as fileName, and
+// queues the one before it. Needs the context the frame was drawn in.
+void captureFrame(const char *fileName) {
+	startFrameEncoders();
+
+	// the buffers follow the size of the window
+	if (capturePBOs[0] == 0 || capturePBOWidth != screenWidth || capturePBOHeight != screenHeight) {
+		finishCapture();
+		if (capturePBOs[0] == 0) glGenBuffers(2, capturePBOs);
+		for (int pbo = 0; pbo < 2; pbo++) {
+			glBindBuffer(GL_PIXEL_PACK_BUFFER, capturePBOs[pbo]);
+			glBufferData(GL_PIXEL_PACK_BUFFER, 4L * screenWidth * screenHeight, NULL, GL_STREAM_READ);
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		capturePBOWidth = screenWidth;
+		capturePBOHeight = screenHeight;
+	}
+
+	// returns right away, the pixels arrive in the buffer later
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, capturePBOs[captureNext]);
+	glReadPixels(0, 0, capturePBOWidth, capturePBOHeight, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	capturePBONames[captureNext] = fileName;
+
+	// the other buffer holds the previous frame, and is the next to be overwritten
+	captureNext = 1 - captureNext;
+	queueCapturedPBO(captureNext);
+	return;
+}
+
+// queues the frame still in flight and waits until every frame is written
+void finishCapture(void) {
+	if (capturePBOs[0] != 0) {
+		queueCapturedPBO(captureNext);
+		queueCapturedPBO(1 - captureNext);
+	}
+
+	pthread_mutex_lock(&captureMutex);
+	while (!captureQueue.empty() || captureEncoding > 0) {
+		pthread_cond_wait(&captureDone, &captureMutex);
+	}
+	pthread_mutex_unlock(&captureMutex);
+	return;
+}
+
+// Makes a GL context on an offscreen pbuffer. Mesa's surfaceless platform
+// needs no display server or GPU; the default display is the fallback.
+bool initHeadlessContext(void) {
+	PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+			(PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+	if (getPlatformDisplay != NULL) {
+		headlessDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+	}
+	EGLint major, minor;
+	if (headlessDisplay == EGL_NO_DISPLAY || !eglInitialize(headlessDisplay, &major, &minor)) {
+		headlessDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+		if (headlessDisplay == EGL_NO_DISPLAY || !eglInitialize(headlessDisplay, &major, &minor)) {
+			#ifndef ERROR_NOTIFICATION_OFF
+			fprintf(stderr, "Error: Couldn't initialize EGL.\n");
+			#endif
+			return false;
+		}
+	}
+
+	const EGLint configAttribs[] = {
+		EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+		EGL_RED_SIZE, 8, EGL_GREEN_SIZE, 8, EGL_BLUE_SIZE, 8, EGL_ALPHA_SIZE, 8,
+		EGL_DEPTH_SIZE, 24,
+		EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+		EGL_NONE
+	};
+	const EGLint pbufferAttribs[] = {EGL_WIDTH, screenWidth, EGL_HEIGHT, screenHeight, EGL_NONE};
+	EGLConfig config;
+	EGLint numConfigs;
+	if (!eglChooseConfig(headlessDisplay, configAttribs, &config, 1, &numConfigs) || numConfigs == 0 ||
+			!eglBindAPI(EGL_OPENGL_API)) {
+		#ifndef ERROR_NOTIFICATION_OFF
+		fprintf(stderr, "Error: EGL has no offscreen OpenGL config.\n");
+		#endif
+		return false;
+	}
+
+	headlessSurface = eglCreatePbufferSurface(headlessDisplay, config, pbufferAttribs);
+	headlessContext = eglCreateContext(headlessDisplay, config, EGL_NO_CONTEXT, NULL);
+	if (headlessSurface == EGL_NO_SURFACE || headlessContext == EGL_NO_CONTEXT ||
+			!eglMakeCurrent(headlessDisplay, headlessSurface, headlessSurface, headlessContext)) {
+		#ifndef ERROR_NOTIFICATION_OFF
+		fprintf(stderr, "Error: Couldn't make a %dx%d offscreen context.\n", screenWidth, screenHeight);
+		#endif
+		return false;
+	}
+
+	#ifdef CONSOLE_OUTPUT
+	printf("Rendering headless with EGL %d.%d, %s\n", major, minor, glGetString(GL_RENDERER));
+	#endif
+	return true;
+}
+
+// seconds on a clock that isn't affected by the worker threads, unlike clock()
+double wallTime(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Renders headlessFirst..headlessLast of headlessAttr and saves every frame.
+// Each frame waits for the map tiles in view, so every image is complete.
+// Reports the frames per second and how long rendering had to wait on the encoders.
+void renderHeadless(void) {
+	if (headlessLast < 0 || headlessLast >= totalTimeSteps) headlessLast = totalTimeSteps - 1;
+	if (headlessFirst < 0) headlessFirst = 0;
+
+	weatherAttrNum = headlessAttr;
+	if (weatherAttrNum == OBSERVED_SNOWPACK) {
+		if (observedData == NULL) computeObservedSnowpack();
+		if (observedData == NULL) weatherAttrNum = SNOWPACK;
+	}
+	reshape(screenWidth, screenHeight);
+
+	// the pyramids have to be there to know which tiles to ask for
+	while (!tileLoaderThreads.empty()) {
+		pthread_mutex_lock(&tileMutex);
+		bool built = pyramidsDone == mapImages.size();
+		pthread_mutex_unlock(&tileMutex);
+		if (built) break;
+		usleep(1000);
+	}
+
+	double start = wallTime();
+	int numFrames = 0;
+	for (int timeStep = headlessFirst; timeStep <= headlessLast; timeStep++) {
+		currentTimeStep = timeStep;
+		if (streaming) setStreamPosition(currentTimeStep, 1);
+
+		redraw();
+		while (tilesPending()) {
+			if (uploadDecodedTiles() > 0) redraw();
+			else usleep(1000);
+		}
+
+		char fileName[1024];
+		snprintf(fileName, sizeof(fileName), "%s%05d.png", headlessPrefix, timeStep);
+		captureFrame(fileName);
+		numFrames++;
+	}
+	finishCapture();
+	double elapsed = max(wallTime() - start, 1e-9);
+
+	printf("Rendered %d frames in %.2f seconds, %.1f frames/s(%.2f seconds of it waiting on the encoders)\n",
+			numFrames, elapsed, numFrames / elapsed, captureWaitTime);
+	return;
+}
+
 int main(int argc, char **argv)
 {
+	// options come before the positional file arguments
+	int opt;
+	while ((opt = getopt(argc, argv, "+a:c:Cj:Lo:r:s:t:w:")) != -1) {
+		switch (opt) {
+			case 'a':
+				// numbered like the keys
+				headlessAttr = atoi(optarg) - 1;
+				if (headlessAttr < ATTR_MIN || headlessAttr > ATTR_MAX) headlessAttr = SNOWPACK;
+				break;
+			case 'c':
+				weatherCachePath = optarg;
+				break;
+			case 'C':
+				weatherCachePath = NULL;
+				break;
+			case 'j':
+				numIngestThreads = atoi(optarg);
+				break;
+			case 'L':
+				buildTimeMajor = false;
+				break;
+			case 'o':
+				headless = true;
+				headlessPrefix = optarg;
+				break;
+			case 'r':
+				regionFileNum = atoi(optarg);
+				break;
+			case 's':
+				sscanf(optarg, "%dx%d", &screenWidth, &screenHeight);
+				break;
+			case 't':
+				if (sscanf(optarg, "%d:%d", &headlessFirst, &headlessLast) == 1) headlessLast = headlessFirst;
+				break;
+			case 'w':
+				streaming = true;
+				streamWindow = atoi(optarg);
+				break;
+			default:
+				#ifndef ERROR_NOTIFICATION_OFF
+				cerr << "usage: ingest [-c cachefile | -C] [-j workers] [-L] [-r region shapefile number] [-w timesteps] [-o prefix [-a attribute] [-t first:last] [-s widthxheight]] <datafiles> <shapefiles>" << endl;
+				#endif
+				exit(1);
+		}
+	}
+
 	// command line should be parsed by something tbd
-	if (argc < 3) {
+	if (argc - optind < 2) {
 		#ifndef ERROR_NOTIFICATION_OFF
-		cerr << "usage: ingest <datafiles> <shapefiles>" << endl;
+		cerr << "usage: ingest [-c cachefile | -C] [-j workers] [-L] [-r region shapefile number] [-w timesteps] [-o prefix [-a attribute] [-t first:last] [-s widthxheight]] <datafiles> <shapefiles>" << endl;
 		#endif
 		exit(1);
 	}
-	int currArgNum = 1;
+	int currArgNum = optind;
 
 	// arg 1 is wildcarded list of files to ingest
 	char **ncFileList;
@@ -2809,72 +6806,105 @@ int main(int argc, char **argv)
 	wordexp(argv[currArgNum], &p, 0);
 	numNcFiles = p.we_wordc;
 	ncFileList = p.we_wordv;
+	ncFileNames = ncFileList;
 
 	#ifdef CONSOLE_OUTPUT
 	printf("Processing %d Ncfiles total.\n", numNcFiles);
 	#endif
 
 	currArgNum++;
-	// For now we are assuming that all the files matched are the same format - not good
-	NcFile ncF(ncFileList[0]);
-	// minimal checking
-	if (!ncF.is_valid()) {
-		fprintf(stderr, "Error: File %s is not valid. Aborting.\n", ncFileList[0]);
-		exit(1);
+	// a cache hit skips reading the Ncfiles entirely
+	bool cachedWeatherData = loadWeatherCache(ncFileList);
+	bool cacheIngest = false;
+	if (cachedWeatherData) {
+		precomputeGridParameters();
+		// the mapped cache is already paged in on demand
+		#ifdef CONSOLE_OUTPUT
+		if (streaming) printf("Using the weather cache instead of streaming.\n");
+		#endif
+		streaming = false;
 	}
+	else {
+		// For now we are assuming that all the files matched are the same format - not good
+		NcFile ncF(ncFileList[0]);
+		// minimal checking
+		if (!ncF.is_valid()) {
+			fprintf(stderr, "Error: File %s is not valid. Aborting.\n", ncFileList[0]);
+			exit(1);
+		}
 
-	// First file will do for reading the x/y coordinates and to determine
-	// array size for reading the remaining files
-	precomputeWeatherParameters(&ncF);
+		// First file will do for reading the x/y coordinates and to determine
+		// array size for reading the remaining files
+		precomputeWeatherParameters(&ncF);
+
+		if (streaming) allocateStreamSpace();
+		else allocateWeatherDataSpace(&ncF);
+	}
 
-	allocateWeatherDataSpace(&ncF);
-	
 	parseTransferFile("transfer.txt");
 
-	getNcFileData(ncFileList);
+	if (streaming) {
+		getNcFileStreamData(ncFileList);
+		startStreamLoader();
+	}
+	// don't cache a run with files missing from it, it would never be rebuilt
+	else if (!cachedWeatherData) cacheIngest = getNcFileData(ncFileList);
 
 	char *shapeFileName;
 	int error = 0;
+	int firstShapeArgNum = currArgNum;
 	// get data from the shapefile(s)
 	while (argv[currArgNum] != NULL) {
 		shapeFileName = argv[currArgNum];
 		// we want fileNum to start at zero
-		error = getShapeFileData(currArgNum - 2, shapeFileName);
+		error = getShapeFileData(currArgNum - firstShapeArgNum, shapeFileName);
 		// stop when there's no args or we hit a non-shapefile
 		if (error == -1) break;
 		currArgNum++;
 	}
 	
-	// with all weather data cached, find the maxs and mins for all attributes
-	computeMaxsAndMins();
+	// the maxs and mins were found during the ingest, save them with the data
+	if (cacheIngest) writeWeatherCache(ncFileList);
+	#ifndef ERROR_NOTIFICATION_OFF
+	else if (!cachedWeatherData && !streaming) {
+		fprintf(stderr, "Error: Some Ncfiles couldn't be read, not writing the weather cache.\n");
+	}
+	#endif
+
+	// streaming mode never has the whole run resident to transpose, and
+	// headless mode has no probe to use it
+	if (buildTimeMajor && !streaming && !headless) startTimeMajorBuilder();
 
 	// OpenGL setup
-	glutInit(&argc, argv);
-	glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH | GLUT_MULTISAMPLE);
-	glutInitWindowSize(screenWidth, screenHeight);
-	mainWindow = glutCreateWindow("Weather Simulation");
-	#ifdef FULLSCREEN
-	glutFullScreen();
-	#endif
-
-	glutDisplayFunc(redraw);
-	glutReshapeFunc(reshape);
-	glutIdleFunc(animate);
-	glutVisibilityFunc(vis);
-	glutMouseFunc(mouse);
-	glutMotionFunc(motion);
-	glutKeyboardFunc(key);
-	glutSpecialFunc(specialKey);
+	if (headless) {
+		if (!initHeadlessContext()) exit(1);
+	}
+	else {
+		glutInit(&argc, argv);
+		glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH | GLUT_MULTISAMPLE);
+		glutInitWindowSize(screenWidth, screenHeight);
+		mainWindow = glutCreateWindow("Weather Simulation");
+		#ifdef FULLSCREEN
+		glutFullScreen();
+		#endif
+
+		glutDisplayFunc(redraw);
+		glutReshapeFunc(reshape);
+		glutIdleFunc(animate);
+		glutVisibilityFunc(vis);
+		glutMouseFunc(mouse);
+		glutMotionFunc(motion);
+		glutKeyboardFunc(key);
+		glutSpecialFunc(specialKey);
+	}
 
 	// for transparency
 	glEnable(GL_BLEND); 
 	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-	ilInit();
-	iluInit();
-	ilutInit();
-	ilutRenderer(ILUT_OPENGL);
-	
+	initWeatherBuffers();
+	initShapeBuffers();
+
 	// get the image file names
 	int numImageFiles;
 	char **imageFileList;
@@ -2886,14 +6916,26 @@ int main(int argc, char **argv)
 	printf("Processing %d image files total:\n", numImageFiles);
 	#endif
 
-	// generate textures
-	textures = new GLuint[numImageFiles];
-	glGenTextures(numImageFiles, textures);
-	// initialize the textures
+	// the pyramids are built and the tiles loaded in the background, and
+	// uploaded by animate() as they finish
 	for (int fileNum = 0; fileNum < numImageFiles; fileNum++) {
-		jpeg2texture(fileNum, imageFileList[fileNum]);
+		int numLocations = texCoords.size();
 		parseImageLocation(imageFileList[fileNum]);
+		// skip images without a location
+		if (texCoords.size() == numLocations) continue;
+
+		mapimage_t image;
+		image.fileName = imageFileList[fileNum];
+		string name(image.fileName);
+		if (name.size() > 4 && strcasecmp(name.c_str() + name.size() - 4, ".jpg") == 0) {
+			name.erase(name.size() - 4);
+		}
+		image.pyramidDir = name + ".pyramid";
+		image.width = image.height = image.numLevels = 0;
+		image.ready = false;
+		mapImages.push_back(image);
 	}
+	startTileLoaders();
 
 	// advance to the next command line input
 	currArgNum++;
@@ -2901,12 +6943,16 @@ int main(int argc, char **argv)
 	parseCSVfiles(argv[currArgNum + 1], argv[currArgNum]);
 
 	// default is snowpack
-	weatherData = snowpackData;
 	weatherAttrNum = SNOWPACK;
 
 	// clean up memory on exit
 	atexit(cleanUpMemory);
 
+	if (headless) {
+		renderHeadless();
+		return 0;
+	}
+
 	printf("Starting Simulation.\n");
 	glutMainLoop();
 
@@ -1,2 +0,0 @@
-#! /bin/bash
-export set LD_LIBRARY_PATH=$LD_LIBRARY_PATH:/u/local/apps/lapack++/2.5.2/lib